@@ -100,16 +100,17 @@ void mm_init(void)
         perror("mem_sbrk");
         exit(1);
     }
-    printf("initial heap address: %p\n", heap_listp);
     put_word(heap_listp, 0);                          /* Alignment padding */
     put_word(heap_listp + (1*WSIZE), pack(DSIZE, 1)); /* Prologue header */
-    printf("prologue header address: %p\n", hdr_pointer(heap_listp));
     put_word(heap_listp + (2*WSIZE), pack(DSIZE, 1)); /* Prologue footer */
-    printf("prologue footer address: %p\n", ftr_pointer(heap_listp));
     put_word(heap_listp + (3*WSIZE), pack(0, 1));     /* Epilogue header */
-    printf("epilogue header address: %p\n", hdr_pointer(heap_listp));
+#ifdef DEBUG
+    printf("initial heap address: %p\n", heap_listp);
+    printf("prologue header address: %p\n", heap_listp + (1*WSIZE));
+    printf("prologue footer address: %p\n", heap_listp + (2*WSIZE));
+    printf("epilogue header address: %p\n", heap_listp + (3*WSIZE));
+#endif
     heap_listp += (2*WSIZE);
-    printf("address: %p\n", heap_listp);
     
 
     /* Extend the empty heap with a free block of CHUNKSIZE bytes
@@ -234,7 +235,9 @@ static void *coalesce(void *current_bp)
     size_t prev_alloc = get_alloc(ftr_pointer(prev_blkp(current_bp)));
     size_t next_alloc = get_alloc(hdr_pointer(next_blkp(current_bp)));
     size_t current_block_size = get_size(hdr_pointer(current_bp));
+#ifdef DEBUG
     printf("Coalescing block at %p of size %zu\n", current_bp, current_block_size);  // Debug: Before coalescing
+#endif
 
     /* Case 1, no coalescing is possible as both adjacent blocks are allocated
     * change allocated bit of the header and footer of the current block to free*/
@@ -356,7 +359,9 @@ static void *extend_heap(size_t words)
 static void place(void *bp, size_t asize)
 {
     size_t current_size = get_size(hdr_pointer(bp));
+#ifdef DEBUG
     printf("Placing block of size %zu at %p\n", asize, bp);
+#endif
 
     if ((current_size - asize) >= (MIN_BLOCK_SIZE)) {
         put_word(hdr_pointer(bp), pack(asize, 1));
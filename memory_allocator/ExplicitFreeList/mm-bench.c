@@ -0,0 +1,99 @@
+/*
+ * mm-bench.c - malloc latency against free-list length.
+ *
+ * For each free-list length N, the heap is seeded with N small free blocks
+ * and LARGE_BLOCKS larger free blocks, kept apart by allocated guard blocks
+ * so they cannot coalesce. Because freed blocks are pushed on the front of
+ * their list, freeing the large blocks first leaves the small ones in front.
+ * We then time LARGE_BLOCKS requests for the large size.
+ *
+ * With a single first-fit list every request walks past all N small blocks.
+ * With SEGREGATED_FIT the small and large blocks sit in different size
+ * classes, so the search starts right at a fitting block.
+ *
+ *   make bench && ./mm-bench-ff && ./mm-bench-seg
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mm.h"
+
+#define SMALL_SIZE   16     /* payload of the blocks that clog the free list */
+#define LARGE_SIZE   240    /* payload of the blocks we time requests for */
+#define LARGE_BLOCKS 1000
+
+static const int list_lengths[] = {0, 1000, 2000, 4000, 8000, 16000, 32000};
+
+static double elapsed_ns(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+/*
+ * Allocate n blocks of `size` bytes into blocks[], each followed by an
+ * allocated guard so that freeing them later does not coalesce anything.
+ */
+static void **alloc_guarded(int n, size_t size)
+{
+    void **blocks = malloc((n + 1) * sizeof(void *));
+    if (!blocks) {
+        perror("malloc");
+        exit(1);
+    }
+    for (int i = 0; i < n; i++) {
+        blocks[i] = mm_malloc(size);
+        if (!blocks[i] || !mm_malloc(SMALL_SIZE)) {
+            perror("mm_malloc");
+            exit(1);
+        }
+    }
+    return blocks;
+}
+
+static void free_all(void **blocks, int n)
+{
+    for (int i = 0; i < n; i++) {
+        mm_free(blocks[i]);
+    }
+    free(blocks);
+}
+
+int main(int argc, char **argv)
+{
+#ifdef SEGREGATED_FIT
+    printf("segregated fit\n");
+#else
+    printf("first fit\n");
+#endif
+    printf("%12s %16s\n", "free blocks", "ns per malloc");
+
+    for (size_t i = 0; i < sizeof(list_lengths) / sizeof(list_lengths[0]); i++) {
+        struct timespec start, end;
+        int n = list_lengths[i];
+
+        mm_init();
+        // Carve every block before freeing any, so the free list ends up
+        // as [small blocks][large blocks][rest of the heap]
+        void **large = alloc_guarded(LARGE_BLOCKS, LARGE_SIZE);
+        void **small = alloc_guarded(n, SMALL_SIZE);
+        free_all(large, LARGE_BLOCKS);
+        free_all(small, n);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int j = 0; j < LARGE_BLOCKS; j++) {
+            if (!mm_malloc(LARGE_SIZE)) {
+                perror("mm_malloc");
+                exit(1);
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        mm_checkheap(0);
+        mm_deinit();
+
+        printf("%12d %16.1f\n", n + LARGE_BLOCKS,
+               elapsed_ns(&start, &end) / LARGE_BLOCKS);
+    }
+    return 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * mm-hbench.c - heap walk latency with and without huge pages.
+ *
+ * For each heap size, the heap is filled with blocks of random sizes and
+ * every other block is freed in random order, so the free lists jump all
+ * over the heap. We then time a full mm_validate, which walks every block
+ * and then every free list entry, and mm_get_fit_stats, which walks only
+ * the free lists. On a large heap with 4 KB pages most of those steps miss
+ * the TLB, while 2 MB pages cover the whole heap with a few hundred entries.
+ *
+ *   make hbench && ./mm-hbench && ./mm-hbench-huge
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "mm.h"
+#include "mem.h"
+
+#define MIN_SIZE 16     /* smallest payload requested */
+#define MAX_SIZE 4096   /* largest payload requested */
+#define REPEAT   3      /* timed walks per heap, the fastest is reported */
+
+static const size_t heap_mb[] = {64, 256, 1024};
+
+static double elapsed_ns(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+int main(int argc, char **argv)
+{
+#ifdef HUGE_PAGES
+    printf("huge pages requested\n");
+#else
+    printf("normal pages\n");
+#endif
+    printf("%8s %10s %10s %18s %18s\n", "heap MB", "blocks", "page", "validate ns/blk", "free walk ns/blk");
+
+    for (size_t i = 0; i < sizeof(heap_mb) / sizeof(heap_mb[0]); i++) {
+        size_t target = heap_mb[i] << 20, bytes = 0, n = 0;
+        size_t cap = target / MIN_SIZE;
+        void **blocks = malloc(cap * sizeof(void *));
+        double validate = 0, walk = 0;
+
+        if (!blocks) {
+            perror("malloc");
+            exit(1);
+        }
+        mm_init();
+        while (bytes < target && n < cap) {
+            size_t size = MIN_SIZE + rng() % (MAX_SIZE - MIN_SIZE);
+
+            if ((blocks[n++] = mm_malloc(size)) == NULL) {
+                perror("mm_malloc");
+                exit(1);
+            }
+            bytes += size;
+        }
+
+        // Free the even blocks in shuffled order
+        for (size_t j = n / 2; j > 1; j--) {
+            size_t k = rng() % j;
+            void *tmp = blocks[2 * (j - 1)];
+            blocks[2 * (j - 1)] = blocks[2 * k];
+            blocks[2 * k] = tmp;
+        }
+        for (size_t j = 0; j < n; j += 2) {
+            mm_free(blocks[j]);
+        }
+
+        for (int r = 0; r < REPEAT; r++) {
+            struct timespec start, mid, end;
+            struct mm_error error;
+            struct mm_fit_stats stats;
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if (mm_validate(MM_CHECK_FULL, &error, 1) != 0) {
+                fprintf(stderr, "%p: %s\n", error.block, mm_strerror(error.kind));
+                exit(1);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &mid);
+            mm_get_fit_stats(&stats);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            double v = elapsed_ns(&start, &mid) / n, w = elapsed_ns(&mid, &end) / stats.free_blocks;
+            if (r == 0 || v < validate) {
+                validate = v;
+            }
+            if (r == 0 || w < walk) {
+                walk = w;
+            }
+        }
+
+        printf("%8zu %10zu %10s %18.2f %18.2f\n", heap_mb[i], n,
+               mem_huge_page_size() ? "2 MB" : "4 KB", validate, walk);
+        mm_deinit();
+        free(blocks);
+    }
+    return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * mm-tbench.c - malloc/free throughput of the THREAD_SAFE build against
+ * thread count.
+ *
+ * Every thread repeatedly allocates a batch of small blocks of mixed sizes
+ * and frees them again. With per-thread caches almost none of these calls
+ * take the heap lock, so throughput should grow with the number of threads
+ * up to the number of cores.
+ *
+ *   make bench && ./mm-tbench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "mm.h"
+
+#define ROUNDS 20000
+#define BATCH  32
+
+static const int thread_counts[] = {1, 2, 4, 8, 16};
+
+static double elapsed_s(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void *worker(void *arg)
+{
+    unsigned int seed = (unsigned int)(size_t)arg;
+    void *blocks[BATCH];
+
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < BATCH; i++) {
+            // 16 to 256 byte payloads, all within the cached size classes
+            if ((blocks[i] = mm_malloc(16 + rand_r(&seed) % 241)) == NULL) {
+                perror("mm_malloc");
+                exit(1);
+            }
+            *(char *)blocks[i] = 'A';
+        }
+        for (int i = 0; i < BATCH; i++) {
+            mm_free(blocks[i]);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    double base = 0;
+
+    printf("%8s %16s %10s\n", "threads", "ops/sec", "speedup");
+
+    for (size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++) {
+        int nthreads = thread_counts[i];
+        pthread_t threads[nthreads];
+        struct timespec start, end;
+
+        mm_init();
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int t = 0; t < nthreads; t++) {
+            if (pthread_create(&threads[t], NULL, worker, (void *)(size_t)(t + 1)) != 0) {
+                perror("pthread_create");
+                exit(1);
+            }
+        }
+        for (int t = 0; t < nthreads; t++) {
+            pthread_join(threads[t], NULL);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        mm_checkheap(0);
+        mm_deinit();
+
+        double ops = 2.0 * ROUNDS * BATCH * nthreads / elapsed_s(&start, &end);
+        if (base == 0) {
+            base = ops;
+        }
+        printf("%8d %16.0f %9.2fx\n", nthreads, ops, ops / base);
+    }
+    return 0;
+}
@@ -2,6 +2,62 @@
 #include <stdlib.h>
 
 #include "mm.h"
+#include "mem.h"
+
+#ifdef THREAD_SAFE
+#include <pthread.h>
+#endif
+
+static void *malloc_512(void *arg)
+{
+    char *p[20];
+
+    for (int i = 0; i < 20; i++) {
+        if ((p[i] = mm_malloc(512)) == NULL) {
+            perror("mm_malloc");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < 20; i++) {
+        mm_free(p[i]);
+    }
+    return arg;
+}
+
+#ifdef THREAD_SAFE
+static void *malloc_48(void *arg)
+{
+    char **p = arg;
+
+    for (int i = 0; i < 40; i++) {
+        if ((p[i] = mm_malloc(48)) == NULL) {
+            perror("mm_malloc");
+            exit(1);
+        }
+    }
+    return arg;
+}
+
+static void *free_48(void *arg)
+{
+    char **p = arg;
+
+    for (int i = 0; i < 40; i++) {
+        mm_free(p[i]);
+    }
+    return arg;
+}
+#endif
+
+// Heap bytes not on a free list, after merging any parked blocks
+static size_t heap_in_use(void)
+{
+    struct mm_fit_stats stats;
+
+    mm_trim();
+    mm_get_fit_stats(&stats);
+    return mem_heapsize() - stats.free_bytes;
+}
 
 int main(int argc, char **argv)
 {
@@ -23,5 +79,117 @@ int main(int argc, char **argv)
     mm_checkheap(1);
     mm_free(q);
     mm_checkheap(1);
+
+    // Corrupt a free block's footer and make sure the checker notices
+    struct mm_error errors[4];
+    p = mm_malloc(2000);
+    q = mm_malloc(2000);
+    mm_free(p);
+    if (mm_validate(MM_CHECK_TOUCHED, errors, 4) != 0) {
+        fprintf(stderr, "%p: %s\n", errors[0].block, mm_strerror(errors[0].kind));
+        exit(1);
+    }
+    size_t *footer = (size_t *)(q - 16);
+    size_t saved = *footer;
+    *footer ^= 16;
+    int n = mm_validate(MM_CHECK_FULL, errors, 4);
+    if (n == 0) {
+        fprintf(stderr, "mm_validate missed a corrupt footer\n");
+        exit(1);
+    }
+    fprintf(stderr, "found: %p: %s\n", errors[0].block, mm_strerror(errors[0].kind));
+    *footer = saved;
+    mm_free(q);
+    if (mm_validate(MM_CHECK_FULL, errors, 4) != 0) {
+        fprintf(stderr, "%p: %s\n", errors[0].block, mm_strerror(errors[0].kind));
+        exit(1);
+    }
+
+    // Free a batch of blocks at once
+    void *batch[8];
+    for (int i = 0; i < 8; i++) {
+        if ((batch[i] = mm_malloc(16 * (i + 1))) == NULL) {
+            perror("mm_malloc");
+            exit(1);
+        }
+    }
+    batch[3] = NULL;
+    mm_free(batch[2]);
+    batch[2] = NULL;
+    mm_free_batch(batch, 8);
+    mm_checkheap(0);
+    mm_stats_dump(stderr);
+
+    // Blocks touched before a re-init are not checked against the new heap
+    for (int i = 0; i < 8; i++) {
+        if ((batch[i] = mm_malloc(64)) == NULL) {
+            perror("mm_malloc");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < 8; i += 2) {
+        mm_free(batch[i]);
+    }
+    mm_deinit();
+    mm_init();
+    if (mm_malloc(5000) == NULL) {
+        perror("mm_malloc");
+        exit(1);
+    }
+    if (mm_validate(MM_CHECK_TOUCHED, errors, 4) != 0) {
+        fprintf(stderr, "after re-init: %p: %s\n", errors[0].block, mm_strerror(errors[0].kind));
+        exit(1);
+    }
+    mm_deinit();
+
+    // Free 544-byte blocks, kept apart by guards so they don't coalesce,
+    // then ask for 512 bytes, whose 528-byte blocks place() serves from
+    // them whole. On a fresh heap, once everything is freed again, no
+    // bytes may be left allocated.
+    mm_init();
+    size_t in_use = heap_in_use();
+    char *big[20], *guard[20];
+    for (int i = 0; i < 20; i++) {
+        big[i] = mm_malloc(528);
+        guard[i] = mm_malloc(600);  // too big for the per-thread caches
+        if (!big[i] || !guard[i]) {
+            perror("mm_malloc");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < 20; i++) {
+        mm_free(big[i]);
+    }
+#ifdef THREAD_SAFE
+    // A thread's cached blocks go back to the heap when it exits
+    pthread_t thread;
+    pthread_create(&thread, NULL, malloc_512, NULL);
+    pthread_join(thread, NULL);
+#else
+    malloc_512(NULL);
+#endif
+    for (int i = 0; i < 20; i++) {
+        mm_free(guard[i]);
+    }
+    if (heap_in_use() != in_use) {
+        fprintf(stderr, "%zu bytes leaked\n", heap_in_use() - in_use);
+        exit(1);
+    }
+    mm_checkheap(0);
+
+#ifdef THREAD_SAFE
+    // One thread allocates, another only frees: the blocks the second one
+    // caches go back to the heap when it exits too
+    char *shared[40];
+    pthread_create(&thread, NULL, malloc_48, shared);
+    pthread_join(thread, NULL);
+    pthread_create(&thread, NULL, free_48, shared);
+    pthread_join(thread, NULL);
+    if (heap_in_use() != in_use) {
+        fprintf(stderr, "%zu bytes leaked by a free-only thread\n", heap_in_use() - in_use);
+        exit(1);
+    }
+    mm_checkheap(0);
+#endif
     mm_deinit();
 }
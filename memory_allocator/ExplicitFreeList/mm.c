@@ -6,6 +6,11 @@
 #include <inttypes.h>
 #include <stddef.h>
 #include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#ifdef THREAD_SAFE
+#include <pthread.h>
+#endif
 
 
 #include "mm.h"
@@ -20,13 +25,29 @@
  * free virtual memory from the heap.
  *  our helper function that helps creates malloc are the following
  * 
- * - First-fit placement strategy
+ * - First-fit placement by default, or next fit or bounded best fit chosen
+ *   with mm_init_policy
+ * - Segregated fit (power-of-two size classes) when built with SEGREGATED_FIT
+ * - Best fit from a size-keyed treap for large free blocks when built with
+ *   SIZE_TREE
  * - Boundary tag coalescing for adjacent free blocks
  * - next and previous pointers for free payloads
+ * - Per-thread caches in front of a locked heap when built with THREAD_SAFE
+ * - Freed blocks parked on quick lists and coalesced in batches when built
+ *   with DEFERRED_COALESCE
+ * - Large free blocks and a large free block at the top of the heap are
+ *   given back to the OS
+ * - Huge blocks get a mapping of their own, outside the heap
+ * - Call and event counters for mm_stats when built with MM_STATS
  * - Minimum block size of 32 bytes (header, footer, and alignment padding)
+ * - Allocated blocks without footers when built with FOOTER_ELISION
+ * - A heap on 2 MB pages, grown 2 MB at a time, when built with HUGE_PAGES
  *
  * Key Features:
  * - Header and footer include size (60 bits) and allocation status (1 bit).
+ * - With FOOTER_ELISION, headers also record whether the previous block is
+ *   allocated (1 bit), and only free blocks carry a footer.
+ * - Headers of mapped blocks have the mmapped bit set.
  * - Blocks are coalesced when freed to reduce fragmentation.
  * - Memory is extended as needed using `mem_sbrk`.
  */
@@ -35,16 +56,114 @@
 #define WSIZE       8       /* Word and header/footer size (bytes) */
 #define DWORD_SIZE  16      /* Double-word size (bytes) */
 #define CHUNKSIZE   4096    /* Extend heap by this amount (bytes) */
+#define RELEASE_THRESHOLD (64 * 1024)  /* madvise the pages of free blocks this large */
+#define TRIM_THRESHOLD   (128 * 1024)  /* shrink the heap when its top free block is this large */
 #define ALIGN(size) (((size) + (0XF)) & ~(0XF)) /* for 32 byte alignment */
+#define MIN_BLOCK_LOG2 5    /* log2 of the 32 byte minimum block size */
+
+/*
+ * Number of free lists. The default build keeps a single list and does a
+ * plain first-fit search. With SEGREGATED_FIT, free blocks are bucketed by
+ * floor(log2(size)): bucket 0 holds 32-63 byte blocks, bucket 1 holds
+ * 64-127 byte blocks, and so on, with the last bucket taking everything
+ * larger.
+ */
+#ifdef SEGREGATED_FIT
+#define NUM_SIZE_CLASSES 20
+#else
+#define NUM_SIZE_CLASSES 1
+#endif
+
+/*
+ * Size tree (SIZE_TREE builds). Free blocks of TREE_THRESHOLD bytes or more
+ * are kept in a treap ordered by size, then address, instead of on a free
+ * list. The tree links reuse the free list link words, and each node's
+ * priority is a hash of its address, so the tree needs no space beyond
+ * what a free block already has. find_fit takes the smallest tree block
+ * that fits, in O(log n) expected time however many large blocks are free.
+ */
+#ifndef TREE_THRESHOLD
+#define TREE_THRESHOLD 1024
+#endif
+
+/*
+ * Requests of MMAP_THRESHOLD bytes or more get their own mapping from
+ * mem_map instead of a heap block, and free unmaps it. Such a block never
+ * fragments or pins the heap, and realloc resizes it with mremap, which
+ * moves pages instead of copying bytes. The header sits in the second word
+ * of the mapping, so the payload is 16-byte aligned, and its size is the
+ * length of the whole mapping.
+ */
+#ifndef MMAP_THRESHOLD
+#define MMAP_THRESHOLD (256 * 1024)
+#endif
+
+/*
+ * Per-thread cache (THREAD_SAFE builds). Bin i holds allocated-but-unused
+ * blocks of exactly 32 + 16 * i bytes, the same 16-byte classes mm_malloc
+ * rounds requests to, so bins cover blocks of 32 to 528 bytes.
+ */
+#define TCACHE_BINS   32
+#define TCACHE_MAX    64    /* flush half of a bin once it holds this many */
+#define TCACHE_REFILL 16    /* blocks taken from the heap when a bin runs dry */
+
+/*
+ * Deferred coalescing (DEFERRED_COALESCE builds). A freed block of up to
+ * 32 + 16 * (QUICK_BINS - 1) bytes is pushed on the quick list for its
+ * exact size and stays marked allocated, so freeing it does no boundary
+ * tag work and a later request of the same size pops it straight back.
+ * The parked blocks are freed and coalesced together when a request finds
+ * no fit, or when they add up to QUICK_MAX_BYTES.
+ */
+#define QUICK_BINS      64
+#define QUICK_MAX_BYTES (256 * 1024)
+
+/*
+ * Huge pages (HUGE_PAGES builds). mm_init asks libmem for a heap backed by
+ * 2 MB pages, and if it gets one the heap grows and trims in steps of
+ * chunk_size = 2 MB instead of CHUNKSIZE, so the page at the break is never
+ * left partly used. Without huge pages from the system the build behaves
+ * like the default one.
+ */
+static size_t chunk_size = CHUNKSIZE;
+
+/*
+ * Footer elision (FOOTER_ELISION builds). coalesce only needs the previous
+ * block's footer when that block is free, so allocated blocks skip the
+ * footer and each header's prev_alloc bit says whether the block before it
+ * is allocated. An allocated block then costs one word of overhead instead
+ * of two. Free blocks still need their footer, and the links, so the
+ * minimum block stays at 32 bytes.
+ */
+#if defined(FOOTER_ELISION) && defined(THREAD_SAFE)
+/*
+ * set_allocated and set_free rewrite the next block's header word, under
+ * heap_lock, to update its prev_alloc bit, while the owner of that block
+ * may be reading the same word without the lock in mm_free or tcache_push.
+ */
+#error "FOOTER_ELISION can't be combined with THREAD_SAFE"
+#endif
+
+#ifdef FOOTER_ELISION
+#define ALLOC_OVERHEAD WSIZE
+#else
+#define ALLOC_OVERHEAD DWORD_SIZE
+#endif
+
 /*
  * Block Header and Footer Structures:
  * - `size`: Block size in bytes (60 bits).
+ * - `mmapped`: Set for a block with its own mapping (1 bit, header only).
+ * - `prev_alloc`: Allocation status of the previous block (1 bit, only
+ *   maintained in FOOTER_ELISION builds).
  * - `allocated`: Allocation status (1 bit: 0 = free, 1 = allocated).
  */
 typedef struct header {
-    uint64_t      size : 60; 
-    uint64_t    unused :  3;
-    uint64_t allocated :  1;
+    uint64_t       size : 60; 
+    uint64_t     unused :  1;
+    uint64_t    mmapped :  1;
+    uint64_t prev_alloc :  1;
+    uint64_t  allocated :  1;
 
     union {
         // These links overlap with the first 16 bytes of a block's payload.
@@ -52,6 +171,11 @@ typedef struct header {
             struct header *fprev, *fnext;
         } links;
 
+        // Children of a block in the size tree (SIZE_TREE builds)
+        struct {
+            struct header *left, *right;
+        } tree;
+
         char payload[0];
     };
 }header_t; 
@@ -59,9 +183,10 @@ typedef struct header {
 //static header_t *sentinel = NULL;
 
 typedef struct {
-    uint64_t      size : 60;
-    uint64_t    unused :  3;
-    uint64_t allocated :  1;
+    uint64_t       size : 60;
+    uint64_t     unused :  2;
+    uint64_t prev_alloc :  1;
+    uint64_t  allocated :  1;
 }footer_t;
 
 typedef struct aligned_header{
@@ -101,6 +226,162 @@ static inline footer_t *footer(void *payload) {
    return ftr_addr;
    
 }
+static inline int floor_log2(uint64_t num) {
+    return 64 - __builtin_clzl(num) - 1;
+}
+
+/*
+ * Heads of the circular free lists, one per size class. Each head is a
+ * sentinel that never leaves its list, so an empty list is a head whose
+ * links point back at itself.
+ */
+static header_t free_lists[NUM_SIZE_CLASSES];
+
+/*
+ * Placement policy. Next fit keeps a rover per free list, the block after
+ * the last fit, and resumes the search there instead of at the head. Best
+ * fit looks at up to best_fit_candidates free blocks that fit (all of them
+ * if <= 0) and takes the smallest.
+ */
+static enum mm_fit_policy fit_policy = MM_FIRST_FIT;
+static int best_fit_candidates = 0;
+static header_t *rovers[NUM_SIZE_CLASSES];
+
+/* Root of the size tree, NULL when it is empty or in builds without it */
+static header_t *tree_root = NULL;
+
+/*
+ * in_tree: Returns whether a free block of `size` bytes belongs in the size tree.
+ */
+static inline int in_tree(size_t size) {
+#ifdef SIZE_TREE
+    return size >= TREE_THRESHOLD;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * tree_less: Orders tree blocks by size, and blocks of the same size by address.
+ */
+static inline int tree_less(header_t *a, header_t *b) {
+    return a->size < b->size || (a->size == b->size && a < b);
+}
+
+/*
+ * tree_priority: Heap priority of a tree block, a hash of its address.
+ */
+static inline uint64_t tree_priority(header_t *node) {
+    uint64_t x = (uintptr_t)node;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/*
+ * tree_insert: Adds `node` to the subtree at `root` and returns the new root.
+ */
+static header_t *tree_insert(header_t *root, header_t *node) {
+    if (root == NULL) {
+        node->tree.left = node->tree.right = NULL;
+        return node;
+    }
+    if (tree_less(node, root)) {
+        root->tree.left = tree_insert(root->tree.left, node);
+        if (tree_priority(root->tree.left) > tree_priority(root)) {
+            // Rotate right
+            header_t *child = root->tree.left;
+            root->tree.left = child->tree.right;
+            child->tree.right = root;
+            root = child;
+        }
+    } else {
+        root->tree.right = tree_insert(root->tree.right, node);
+        if (tree_priority(root->tree.right) > tree_priority(root)) {
+            // Rotate left
+            header_t *child = root->tree.right;
+            root->tree.right = child->tree.left;
+            child->tree.left = root;
+            root = child;
+        }
+    }
+    return root;
+}
+
+/*
+ * tree_join: Joins two subtrees where every block in `a` is less than every
+ * block in `b`, and returns the root of the result.
+ */
+static header_t *tree_join(header_t *a, header_t *b) {
+    if (a == NULL) {
+        return b;
+    }
+    if (b == NULL) {
+        return a;
+    }
+    if (tree_priority(a) > tree_priority(b)) {
+        a->tree.right = tree_join(a->tree.right, b);
+        return a;
+    }
+    b->tree.left = tree_join(a, b->tree.left);
+    return b;
+}
+
+/*
+ * tree_delete: Removes `node` from the subtree at `root` and returns the new root.
+ */
+static header_t *tree_delete(header_t *root, header_t *node) {
+    if (root == node) {
+        return tree_join(node->tree.left, node->tree.right);
+    }
+    if (tree_less(node, root)) {
+        root->tree.left = tree_delete(root->tree.left, node);
+    } else {
+        root->tree.right = tree_delete(root->tree.right, node);
+    }
+    return root;
+}
+
+/* find_fit counters for mm_get_fit_stats */
+static size_t fit_searches, fit_blocks_scanned, fit_misses;
+
+/*
+ * Statistics (MM_STATS builds). STAT_INC and STAT_ADD bump a field of
+ * `counters` and compile to nothing otherwise. THREAD_SAFE builds count
+ * outside heap_lock, so there they are relaxed atomic adds.
+ */
+#ifdef MM_STATS
+static struct mm_stats counters;
+static size_t stats_interval;
+#ifdef THREAD_SAFE
+#define STAT_ADD(field, n) __atomic_fetch_add(&counters.field, (n), __ATOMIC_RELAXED)
+#else
+#define STAT_ADD(field, n) (counters.field += (n))
+#endif
+#else
+#define STAT_ADD(field, n) ((void)0)
+#endif
+#define STAT_INC(field) STAT_ADD(field, 1)
+
+/*
+ * size_class: Returns the index of the free list that holds blocks of `size` bytes.
+ */
+static inline int size_class(size_t size) {
+#ifdef SEGREGATED_FIT
+    int class = floor_log2(size) - MIN_BLOCK_LOG2;
+    if (class < 0) {
+        return 0;
+    }
+    return (class < NUM_SIZE_CLASSES) ? class : NUM_SIZE_CLASSES - 1;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * remove_from_freelist: unlinks the free block at `payload` from its list.
+ */
 static inline header_t *remove_from_freelist(void *payload){
     if (!payload) {
         return NULL; // Return NULL if payload is invalid
@@ -108,27 +389,45 @@ static inline header_t *remove_from_freelist(void *payload){
     
     header_t *head = header(payload);
 
-    if (head->links.fprev) {
-        head->links.fprev->links.fnext = head->links.fnext;
+    if (in_tree(head->size)) {
+        tree_root = tree_delete(tree_root, head);
+        return head;
     }
-    if (head->links.fnext) {
-        head->links.fnext->links.fprev = head->links.fprev;
+
+    int class = size_class(head->size);
+
+    // Keep the next-fit rover on the list
+    if (rovers[class] == head) {
+        rovers[class] = head->links.fnext;
     }
 
+    head->links.fprev->links.fnext = head->links.fnext;
+    head->links.fnext->links.fprev = head->links.fprev;
+    head->links.fprev = head->links.fnext = head;
+
     return head;
 }
 
+/*
+ * add_merge_block_to_freelist: pushes the free block at `bp` onto the front
+ * of the list for its size class (LIFO), or into the size tree if it is large.
+ */
 static inline void *add_merge_block_to_freelist(void *bp){
      if (!bp) {
         return NULL; // Return NULL if payload is invalid
     }
-    // save a pointer of the current header block
     header_t *merge_block = header(bp);
-    
-    header(bp)->links.fprev = merge_block; // a pointer of the merge block is save in the tail of the list
-    header(bp)->links.fnext = merge_block->links.fnext; 
-    merge_block->links.fnext->links.fprev = header(bp); // header is save in the tail of the merge block
-    merge_block->links.fnext = header(bp); // save header in the next of the merge block
+
+    if (in_tree(merge_block->size)) {
+        tree_root = tree_insert(tree_root, merge_block);
+        return bp;
+    }
+    header_t *list = &free_lists[size_class(merge_block->size)];
+
+    merge_block->links.fprev = list;
+    merge_block->links.fnext = list->links.fnext;
+    list->links.fnext->links.fprev = merge_block;
+    list->links.fnext = merge_block;
   
     return bp;
 }
@@ -153,12 +452,62 @@ static inline void *next_free_payload(void *payload) {
     return  header(payload)->links.fnext->payload;
 }
 
-static inline void *prev_free_payload(void *payload) {
-    return header(payload)->links.fprev->payload;
+/*
+ * prev_allocated: Returns whether the block before `payload` is allocated.
+ * Without a footer to read, FOOTER_ELISION builds keep this in the header.
+ */
+static inline int prev_allocated(void *payload) {
+#ifdef FOOTER_ELISION
+    return header(payload)->prev_alloc;
+#else
+    return header(prev_payload(payload))->allocated;
+#endif
 }
 
-static inline int floor_log2(uint64_t num) {
-    return 64 - __builtin_clzl(num) - 1;
+/*
+ * set_allocated: Marks the block at `payload` allocated with `size` bytes.
+ */
+static inline void set_allocated(void *payload, size_t size) {
+    header(payload)->size = size;
+    header(payload)->unused = 0;
+    header(payload)->mmapped = 0;
+    header(payload)->allocated = 1;
+#ifdef FOOTER_ELISION
+    header(next_payload(payload))->prev_alloc = 1;
+#else
+    footer(payload)->size = size;
+    footer(payload)->allocated = 1;
+#endif
+}
+
+/*
+ * set_free: Marks the block at `payload` free with `size` bytes.
+ */
+static inline void set_free(void *payload, size_t size) {
+    header(payload)->size = size;
+    header(payload)->unused = 0;
+    header(payload)->mmapped = 0;
+    header(payload)->allocated = 0;
+    footer(payload)->size = size;
+    footer(payload)->allocated = 0;
+#ifdef FOOTER_ELISION
+    header(next_payload(payload))->prev_alloc = 0;
+#endif
+}
+
+/*
+ * set_epilogue: Writes the zero-size allocated header that ends the heap.
+ */
+static inline void set_epilogue(void *payload, int prev_alloc) {
+    header(payload)->size = 0;
+    header(payload)->unused = 0;
+    header(payload)->mmapped = 0;
+    header(payload)->prev_alloc = prev_alloc;
+    header(payload)->allocated = 1;
+}
+
+static inline void *prev_free_payload(void *payload) {
+    return header(payload)->links.fprev->payload;
 }
 
 /* Global pointer to the start of the heap, (char *) 
@@ -169,17 +518,269 @@ static char *heap_listp = NULL;
 static void *extend_heap(size_t words);
 static void place(void *bp, size_t asize);
 static void *find_fit(size_t asize);
+static void *tree_fit(size_t asize);
+static void tree_stats(header_t *node, struct mm_fit_stats *stats);
 static void *coalesce(void *bp);
 static void printblock(void *bp);
 static void checkheap(int verbose);
-static void checkblock(void *bp);
+static inline void touch(void *bp);
+static inline void touch_merge(void *gone, void *bp);
+static inline void touch_trim(void *top);
+static inline void touch_reset(void);
+static void *heap_malloc(size_t asize);
+static void free_block(void *bp);
+static void heap_free(void *bp);
+static void consolidate(void);
+static size_t trim_heap(size_t threshold);
+static void *realloc_in_place(void *bp, size_t asize);
+static void split_allocated(void *bp, size_t asize);
+static inline void stats_tick(void);
+static void stats_print_counters(FILE *fp, struct mm_stats *stats);
+static void *mmap_malloc(size_t size);
+static void *mmap_realloc(void *bp, size_t size);
+static void mmap_free(void *bp);
+
+#ifdef THREAD_SAFE
+/*
+ * Thread-safe build
+ *
+ * The heap itself (the block headers, the free lists, heap_listp and the
+ * break in libmem) is shared and guarded by heap_lock. In front of it each
+ * thread keeps a cache of small blocks, singly linked through links.fnext.
+ * A cached block stays marked allocated, so the heap never sees it and it
+ * is never coalesced; malloc and free of a cached size touch only the
+ * calling thread's bins. The lock is only taken to refill an empty bin or
+ * flush a full one, a batch of blocks at a time.
+ *
+ * mm_init and mm_deinit are not synchronized and must be called while no
+ * other thread is using the allocator.
+ */
+struct tcache {
+    header_t *bins[TCACHE_BINS];
+    int counts[TCACHE_BINS];
+    int registered;
+};
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key;
+static __thread struct tcache tcache;
+
+static inline int tcache_index(size_t size) {
+    return (size - 2 * DWORD_SIZE) / DWORD_SIZE;
+}
+
+/*
+ * tcache_flush - return `n` blocks from bin `i` to the heap. Caller holds heap_lock.
+ */
+static void tcache_flush(struct tcache *tc, int i, int n)
+{
+    while (n-- > 0 && tc->bins[i]) {
+        header_t *hdr = tc->bins[i];
+        tc->bins[i] = hdr->links.fnext;
+        tc->counts[i]--;
+        heap_free(hdr->payload);
+    }
+}
+
+/*
+ * tcache_release - pthread key destructor, hands an exiting thread's
+ * cached blocks back to the heap.
+ */
+static void tcache_release(void *arg)
+{
+    struct tcache *tc = arg;
+
+    pthread_mutex_lock(&heap_lock);
+    for (int i = 0; i < TCACHE_BINS; i++) {
+        tcache_flush(tc, i, tc->counts[i]);
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+static void tcache_key_create(void)
+{
+    if (pthread_key_create(&tcache_key, tcache_release) != 0) {
+        perror("pthread_key_create");
+        exit(1);
+    }
+}
+
+/*
+ * tcache_register - make sure the calling thread's cache is handed back to
+ * the heap when the thread exits. Called before a block first goes into the
+ * cache, whether from a refill or from mm_free.
+ */
+static inline void tcache_register(void)
+{
+    if (!tcache.registered) {
+        pthread_once(&tcache_key_once, tcache_key_create);
+        pthread_setspecific(tcache_key, &tcache);
+        tcache.registered = 1;
+    }
+}
+
+/*
+ * tcache_push - cache the allocated block at `bp` if it has a cached size.
+ * Returns 0 if the block is too large for the cache.
+ */
+static int tcache_push(void *bp)
+{
+    int i = tcache_index(header(bp)->size);
+
+    if (i >= TCACHE_BINS) {
+        return 0;
+    }
+    tcache_register();
+    header(bp)->links.fnext = tcache.bins[i];
+    tcache.bins[i] = header(bp);
+
+    if (++tcache.counts[i] >= TCACHE_MAX) {
+        pthread_mutex_lock(&heap_lock);
+        tcache_flush(&tcache, i, TCACHE_MAX / 2);
+        pthread_mutex_unlock(&heap_lock);
+    }
+    return 1;
+}
+
+/*
+ * tcache_malloc - allocate a block of asize bytes (asize <= 528) from the
+ * calling thread's cache, refilling the bin from the heap when it is empty.
+ */
+static void *tcache_malloc(size_t asize)
+{
+    int i = tcache_index(asize);
+    header_t *hdr;
+    void *bp;
+
+    if ((hdr = tcache.bins[i]) != NULL) {
+        tcache.bins[i] = hdr->links.fnext;
+        tcache.counts[i]--;
+        return hdr->payload;
+    }
+
+    tcache_register();
+
+    pthread_mutex_lock(&heap_lock);
+    for (int n = 1; n < TCACHE_REFILL; n++) {
+        if ((bp = heap_malloc(asize)) == NULL) {
+            break;
+        }
+        // place() may leave up to 16 spare bytes in a block, so file it
+        // under its real size. A block of the top class can outgrow the
+        // bins; it still serves this size, so it goes in bin i.
+        int j = tcache_index(header(bp)->size);
+        if (j >= TCACHE_BINS) {
+            j = i;
+        }
+        header(bp)->links.fnext = tcache.bins[j];
+        tcache.bins[j] = header(bp);
+        tcache.counts[j]++;
+    }
+    bp = heap_malloc(asize);
+    pthread_mutex_unlock(&heap_lock);
+    return bp;
+}
+#endif
+
+#ifdef DEFERRED_COALESCE
+/*
+ * Quick lists, singly linked through links.fnext. Bin i holds blocks of
+ * exactly 32 + 16 * i bytes. In the THREAD_SAFE build they are shared and
+ * guarded by heap_lock, behind the per-thread caches.
+ */
+static header_t *quick_bins[QUICK_BINS];
+static size_t quick_bytes;
+
+static inline int quick_index(size_t size) {
+    return (size - 2 * DWORD_SIZE) / DWORD_SIZE;
+}
+
+/*
+ * quick_malloc - Pop a block of exactly asize bytes off its quick list, or
+ * return NULL if there is none.
+ */
+static inline void *quick_malloc(size_t asize)
+{
+    int i = quick_index(asize);
+    header_t *hdr;
+
+    if (i >= QUICK_BINS || (hdr = quick_bins[i]) == NULL) {
+        return NULL;
+    }
+    STAT_INC(quick_hits);
+    quick_bins[i] = hdr->links.fnext;
+    quick_bytes -= asize;
+    return hdr->payload;
+}
+#endif
+
+/*
+ * heap_free - Free the allocated block at bp into the heap. In the
+ * DEFERRED_COALESCE build a small block is parked on its quick list
+ * instead. In the THREAD_SAFE build the caller holds heap_lock.
+ */
+static void heap_free(void *bp)
+{
+#ifdef DEFERRED_COALESCE
+    size_t size = header(bp)->size;
+    int i = quick_index(size);
+
+    if (i < QUICK_BINS) {
+        header(bp)->links.fnext = quick_bins[i];
+        quick_bins[i] = header(bp);
+        quick_bytes += size;
+        if (quick_bytes >= QUICK_MAX_BYTES) {
+            consolidate();
+        }
+        return;
+    }
+#endif
+    free_block(bp);
+}
+
+/*
+ * consolidate - Free and coalesce every block on the quick lists. Does
+ * nothing in builds without DEFERRED_COALESCE.
+ */
+static void consolidate(void)
+{
+#ifdef DEFERRED_COALESCE
+    if (quick_bytes == 0) {
+        return;
+    }
+    STAT_INC(consolidations);
+    for (int i = 0; i < QUICK_BINS; i++) {
+        header_t *hdr = quick_bins[i];
+
+        quick_bins[i] = NULL;
+        while (hdr) {
+            header_t *next = hdr->links.fnext;
+            free_block(hdr->payload);
+            hdr = next;
+        }
+    }
+    quick_bytes = 0;
+#endif
+}
 
 /*
  * mm_init - Initialize the memory manager for our explicit allocator
- for program correctness, since this is a 64 bit implementatation, our expected
- return address should be a multiple of 16 bytes
+ with first-fit placement
  */
 void mm_init(void)
+{
+    mm_init_policy(MM_FIRST_FIT, 0);
+}
+
+/*
+ * mm_init_policy - Initialize the memory manager with the given placement
+ policy. `candidates` bounds the number of fitting blocks MM_BEST_FIT compares
+ and is ignored by the other policies. For program correctness, since this is a
+ 64 bit implementatation, our expected return address should be a multiple of
+ 16 bytes
+ */
+void mm_init_policy(enum mm_fit_policy policy, int candidates)
 {
     // the struct for header_t is 24 bytes in total, 8 bytes for the header,
     // 8 bytes each for the previous and next pointer in the struct.
@@ -191,7 +792,35 @@ void mm_init(void)
     assert(sizeof(footer_t) == WSIZE);
 
 
+#ifdef HUGE_PAGES
+    mem_set_huge_pages(1);
+#endif
     mem_init();
+    chunk_size = mem_huge_page_size() ? mem_huge_page_size() : CHUNKSIZE;
+
+#ifdef THREAD_SAFE
+    // Blocks cached before a re-init belong to the old heap
+    memset(tcache.bins, 0, sizeof(tcache.bins));
+    memset(tcache.counts, 0, sizeof(tcache.counts));
+#endif
+#ifdef DEFERRED_COALESCE
+    memset(quick_bins, 0, sizeof(quick_bins));
+    quick_bytes = 0;
+#endif
+
+    // Every size class starts out as an empty circular list
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+        free_lists[i].links.fprev = free_lists[i].links.fnext = &free_lists[i];
+        rovers[i] = &free_lists[i];
+    }
+    tree_root = NULL;
+    fit_policy = policy;
+    best_fit_candidates = candidates;
+    fit_searches = fit_blocks_scanned = fit_misses = 0;
+#ifdef MM_STATS
+    memset(&counters, 0, sizeof(counters));
+#endif
+    touch_reset();
 
     /* 
      * Create the initial empty heap. The heap is initialized with a total of 48 bytes, 
@@ -221,6 +850,7 @@ void mm_init(void)
     */ 
     header_t *prologue_hdr = header(heap_listp);
     prologue_hdr->size = ALIGN(2 * DWORD_SIZE);
+    prologue_hdr->prev_alloc = 1;
     prologue_hdr->allocated = 1;
     prologue_hdr->links.fprev = prologue_hdr->links.fnext = prologue_hdr;
     footer_t *prologue_ftr = footer(heap_listp);
@@ -230,15 +860,13 @@ void mm_init(void)
  
     // Initialize epilogue block 
     heap_listp +=  2 * DWORD_SIZE;
-    header_t *epilogue_hdr = header(heap_listp);
-    epilogue_hdr->size = 0;
-    epilogue_hdr->allocated = 1;
+    set_epilogue(heap_listp, 1);
   
 
     heap_listp = (char *)heap_listp -  (2 * DWORD_SIZE);
     
     // Extend the empty heap with a free block of PAGE_SIZE bytes
-    if (extend_heap(CHUNKSIZE >> 4) == NULL) {
+    if (extend_heap(chunk_size / WSIZE) == NULL) {
         perror("extend_heap");
        exit(1);
     }
@@ -248,7 +876,32 @@ void mm_init(void)
 
 void mm_deinit(void)
 {
+#ifdef THREAD_SAFE
+    memset(tcache.bins, 0, sizeof(tcache.bins));
+    memset(tcache.counts, 0, sizeof(tcache.counts));
+#endif
+#ifdef DEFERRED_COALESCE
+    memset(quick_bins, 0, sizeof(quick_bins));
+    quick_bytes = 0;
+#endif
+    touch_reset();
     mem_deinit();
+    heap_listp = NULL;
+}
+
+/* 
+ * adjust_size - Adjust the block size to include overhead and alignment requirements. 
+ * Note that this condition can lead to internal fragmentation. 
+ * For example, if a user repeatedly requests small payloads, the allocator 
+ * will add padding to meet alignment requirements. The unused space in each 
+ * block, caused by the padding, contributes to fragmentation within the heap.
+ */
+static inline size_t adjust_size(size_t size)
+{
+    if (size + ALLOC_OVERHEAD <= 2*DWORD_SIZE){ 
+        return 2*DWORD_SIZE; 
+    }
+    return DWORD_SIZE * ((size + (ALLOC_OVERHEAD) + (DWORD_SIZE-1)) / DWORD_SIZE); 
 }
 
 /*
@@ -273,41 +926,62 @@ void mm_deinit(void)
  *   - The free list is traversed to find a suitable block that has been recently freed.
  *   - Newly freed blocks are inserted at the head of the free list, which allows for efficient 
  *     allocation of recently freed memory.
+ *
+ * In the THREAD_SAFE build, blocks of up to 528 bytes come from the calling thread's cache
+ * and only larger requests take the heap lock.
+ *
+ * Requests of MMAP_THRESHOLD bytes or more are mapped on their own and never touch the heap.
  */
 
 void *mm_malloc(size_t size)
 {
     size_t asize;      /* Adjusted block size for alignment*/
+
+    stats_tick();
+
+    /* Ignore spurious requests */
+    if (size <=  0){
+        return NULL;
+    }
+    /* Huge requests get a mapping of their own */
+    if (size >= MMAP_THRESHOLD) {
+        return mmap_malloc(size);
+    }
+    asize = adjust_size(size);
+
+#ifdef THREAD_SAFE
+    if (tcache_index(asize) < TCACHE_BINS) {
+        return tcache_malloc(asize);
+    }
+    pthread_mutex_lock(&heap_lock);
+    void *bp = heap_malloc(asize);
+    pthread_mutex_unlock(&heap_lock);
+    return bp;
+#else
+    return heap_malloc(asize);
+#endif
+}
+
+/*
+ * heap_malloc - Allocate a block of asize bytes from the heap, initializing
+ * the heap on first use. In the THREAD_SAFE build the caller holds heap_lock.
+ */
+static void *heap_malloc(size_t asize)
+{
     size_t extendsize; /* Amount to extend heap if no fit */
     char *bp;
 
     if (heap_listp == NULL){
         mm_init();
     }
-    /* Ignore spurious requests */
-    if (size <=  0){
-        return NULL;
-    }
-    /*
-     constraint for max size a user can request
-    */
-     if (size >  (CHUNKSIZE * 2)){ 
-        errno = ENOMEM;
-     }
-    /* 
-     * Adjust the block size to include overhead and alignment requirements. 
-     * Note that this condition can lead to internal fragmentation. 
-     * For example, if a user repeatedly requests small payloads, the allocator 
-     * will add padding to meet alignment requirements. The unused space in each 
-     * block, caused by the padding, contributes to fragmentation within the heap.
-     */
-    if (size <= DWORD_SIZE){ 
-        asize = 2*DWORD_SIZE; 
-    }else{
-        asize = DWORD_SIZE * ((size + (DWORD_SIZE) + (DWORD_SIZE-1)) / DWORD_SIZE); 
+#ifdef DEFERRED_COALESCE
+    if ((bp = quick_malloc(asize)) != NULL) {
+        return bp;
     }
+#endif
     /* 
-     * Search the free list for a fit using the first fit placement policy. Note that there may be many small free blocks 
+     * Search the free lists for a fit using the first fit placement policy, starting
+     * at the size class of asize. Note that there may be many small free blocks 
      * that could collectively satisfy a user's request if they were contiguous in memory. 
      * External fragmentation occurs when a user requests a block size, but no suitable 
      * contiguous block is found, even though there is sufficient free memory overall. 
@@ -318,12 +992,23 @@ void *mm_malloc(size_t size)
         place(bp, asize);
         return bp;
     }
+#ifdef DEFERRED_COALESCE
+    // Coalesce the parked blocks and look again before growing the heap
+    if (quick_bytes > 0) {
+        consolidate();
+        if ((bp = find_fit(asize)) != NULL) {
+            place(bp, asize);
+            return bp;
+        }
+    }
+#endif
 
     /* No fit found even with the coalesce, we extend the heap by a chunksize of memory 
     * and place the remaining block in the explicit free list
    */
-    extendsize = ((asize + CHUNKSIZE - 1) >> 12 ) <<  12;
-    if ((bp = extend_heap(extendsize >> 4)) == NULL){
+    fit_misses++;
+    extendsize = (asize + chunk_size - 1) & ~(chunk_size - 1);
+    if ((bp = extend_heap(extendsize / WSIZE)) == NULL){
         return NULL;
     }
     place(bp, asize);
@@ -335,6 +1020,9 @@ void *mm_malloc(size_t size)
  * which keeps track of available blocks on the heap. The actual 
  * merging of adjacent free blocks (if applicable) is handled 
  * by the coalesce function, which performs the heavy lifting.
+ * In the THREAD_SAFE build, small blocks go back to the calling 
+ * thread's cache instead, and in the DEFERRED_COALESCE build they are
+ * parked on a quick list.
  */
 void mm_free(void *bp)
 {
@@ -343,86 +1031,246 @@ void mm_free(void *bp)
     if (bp == NULL) {
         return;
     }
-    
-    coalesce(bp);
+    STAT_INC(free_calls);
+    if (header(bp)->mmapped) {
+        mmap_free(bp);
+        return;
+    }
+
+#ifdef THREAD_SAFE
+    if (tcache_push(bp)) {
+        return;
+    }
+    pthread_mutex_lock(&heap_lock);
+    heap_free(bp);
+    pthread_mutex_unlock(&heap_lock);
+#else
+    heap_free(bp);
+#endif
 }
 
 /*
- * coalesce - Boundary tag coalescing. Returns a pointer to the coalesced block.
- * This function merges adjacent free blocks to reduce external fragmentation 
- * and improve the likelihood of finding contiguous free memory. 
- * Newly merged free blocks are added to the front of the free list for 
- * quick access and removed from their previous positions in the list.
+ * mm_free_batch - Free the n blocks in ptrs, skipping NULL entries. The
+ * THREAD_SAFE build takes heap_lock once for the whole batch, and the
+ * blocks go straight to the heap instead of the thread's cache.
  */
-static void *coalesce(void *current_block)
+void mm_free_batch(void **ptrs, size_t n)
 {
-    void *prev = prev_payload(current_block);
-    void *next = next_payload(current_block);
+#ifdef THREAD_SAFE
+    pthread_mutex_lock(&heap_lock);
+#endif
+    for (size_t i = 0; i < n; i++) {
+        void *bp = ptrs[i];
+
+        if (bp == NULL) {
+            continue;
+        }
+        STAT_INC(free_calls);
+        if (header(bp)->mmapped) {
+            mmap_free(bp);
+        } else {
+            heap_free(bp);
+        }
+    }
+#ifdef THREAD_SAFE
+    pthread_mutex_unlock(&heap_lock);
+#endif
+}
 
-    size_t prev_alloc = header(prev)->allocated;
-    size_t next_alloc = header(next)->allocated;
+/*
+ * free_block - Free the allocated block at bp and give memory back to the OS
+ * where it is worth it. If the coalesced block is the last one in the heap and
+ * at least TRIM_THRESHOLD bytes, the heap is trimmed. Otherwise, if it is at
+ * least RELEASE_THRESHOLD bytes, the whole pages inside it are released with
+ * madvise. They stay part of the heap and fault back in, zeroed, when reused.
+ *
+ * Every free block of RELEASE_THRESHOLD bytes or more has already had its
+ * pages released, so when bp merges with such a neighbour only the pages
+ * that were not part of that neighbour need releasing.
+ */
+static void free_block(void *bp)
+{
+    void *next = next_payload(bp);
+    char *lo = NULL, *hi = NULL;
 
-    size_t current_payload_size = header(current_block)->size; 
+    if (!prev_allocated(bp) && header(prev_payload(bp))->size >= RELEASE_THRESHOLD) {
+        lo = (char *)header(bp);
+    }
+    if (!header(next)->allocated && header(next)->size >= RELEASE_THRESHOLD) {
+        hi = (char *)header(next);
+    }
 
-    if (prev_alloc == 1 && next_alloc == 1) {
+    bp = coalesce(bp);
+    size_t size = header(bp)->size;
+
+    if (size >= TRIM_THRESHOLD && header(next_payload(bp))->size == 0) {
+        trim_heap(TRIM_THRESHOLD);
+    } else if (size >= RELEASE_THRESHOLD) {
+        // Keep the header, free list or tree links and footer resident
+        if (lo == NULL) {
+            lo = (char *)bp + 2 * WSIZE;
+        }
+        if (hi == NULL) {
+            hi = (char *)footer(bp);
+        }
+        mem_release(lo, hi - lo);
+    }
+}
+
+/*
+ * trim_heap - If the last block before the epilogue is free and at least
+ * `threshold` bytes, shrink the heap from the top, leaving chunk_size bytes
+ * (rounded up to a page) in that block. Returns the number of bytes removed.
+ */
+static size_t trim_heap(size_t threshold)
+{
+    void *epilogue = mem_sbrk(0);
+    size_t shrink, remaining;
+
+    if (prev_allocated(epilogue)) {
+        return 0;
+    }
+    void *last = prev_payload(epilogue);
+    size_t size = header(last)->size;
+
+    if (size < threshold || size <= chunk_size) {
+        return 0;
+    }
+    shrink = (size - chunk_size) & ~(chunk_size - 1);
+    if (shrink == 0) {
+        return 0;
+    }
+
+    remove_from_freelist(last);
+    header(last)->size = size - shrink;
+    set_epilogue(next_payload(last), 0);
+    set_free(last, size - shrink);
+    add_merge_block_to_freelist(last);
+    touch_trim(next_payload(last));
+
+    // mem_sbrk takes an int, so give back huge tops in pieces
+    for (remaining = shrink; remaining > 0; ) {
+        int step = (remaining > (1 << 30)) ? (1 << 30) : (int)remaining;
+        mem_sbrk(-step);
+        remaining -= step;
+    }
+    return shrink;
+}
+
+/*
+ * mm_trim - Shrink the heap as far as possible, leaving at most chunk_size
+ * bytes free at the top. Returns the number of bytes removed from the heap.
+ */
+size_t mm_trim(void)
+{
+    size_t trimmed;
+
+#ifdef THREAD_SAFE
+    pthread_mutex_lock(&heap_lock);
+    consolidate();
+    trimmed = heap_listp ? trim_heap(0) : 0;
+    pthread_mutex_unlock(&heap_lock);
+#else
+    consolidate();
+    trimmed = heap_listp ? trim_heap(0) : 0;
+#endif
+    return trimmed;
+}
+
+/*
+ * mm_bytes_returned - Resident bytes given back to the OS so far, by trimming
+ * the heap or by releasing the pages of large free blocks.
+ */
+size_t mm_bytes_returned(void)
+{
+    return mem_bytes_released();
+}
+
+/*
+ * coalesce - Boundary tag coalescing. Returns a pointer to the coalesced block.
+ * This function merges adjacent free blocks to reduce external fragmentation 
+ * and improve the likelihood of finding contiguous free memory. 
+ * `current_block` must not be on any free list. Free neighbours are removed 
+ * from their lists and the merged block is added to the front of the list 
+ * for its size class.
+ */
+static void *coalesce(void *current_block)
+{
+    void *prev = NULL;
+    void *next = next_payload(current_block);
+    void *freed = current_block;
+
+    size_t prev_alloc = prev_allocated(current_block);
+    size_t next_alloc = header(next)->allocated;
+
+    // Only a free predecessor is guaranteed to have a footer to walk back with
+    if (!prev_alloc) {
+        prev = prev_payload(current_block);
+    }
+
+    size_t current_payload_size = header(current_block)->size; 
+
+    if (prev_alloc == 1 && next_alloc == 1) {
         /* Case 1: No coalescing needed, both previous and next blocks are allocated */
-        header_t *new_free_hdr = header(current_block);
-        footer_t *new_free_ftr = footer(current_block);
-        new_free_hdr->size = current_payload_size;
-        new_free_ftr->size = current_payload_size;
-        new_free_hdr->allocated = new_free_ftr->allocated = 0;
-        new_free_hdr->links.fprev = new_free_hdr->links.fnext = new_free_hdr;
-        add_merge_block_to_freelist(current_block);
-        
+        STAT_INC(coalesce[0]);
+
     } else if (prev_alloc == 1 && next_alloc == 0) {
         /* Case 2: Coalesce with the next block, previous block is allocated */
-        current_payload_size += header(next)->size;
-        header(current_block)->size = ALIGN(current_payload_size);
-        footer(current_block)->size = ALIGN(current_payload_size);
-        footer(current_block)->allocated = 0;
-
-        // Remove next from the free list
+        STAT_INC(coalesce[1]);
         remove_from_freelist(next);
+        current_payload_size += header(next)->size;
 
     } else if (prev_alloc == 0 && next_alloc == 1) {
         /* Case 3: Coalesce with the previous block, next block is allocated */
-        current_payload_size += header(prev)->size;
-        footer(current_block)->size = ALIGN(current_payload_size);
-        header(prev)->size = ALIGN(current_payload_size);
-        header(prev)->allocated = 0;
-
-
-        // Remove prev from the free list
+        STAT_INC(coalesce[2]);
         remove_from_freelist(prev);
+        current_payload_size += header(prev)->size;
 
         // Coalesced free block starts at prev now
         current_block = prev;
     } else {
         /* Case 4: Coalesce with both previous and next blocks */
-        current_payload_size += header(prev)->size + footer(next)->size;
-        header(prev)->size = ALIGN(current_payload_size);
-        footer(next)->size = ALIGN(current_payload_size);
-
- 
-        // Remove prev and next from free list
+        STAT_INC(coalesce[3]);
         remove_from_freelist(prev);
         remove_from_freelist(next);
+        current_payload_size += header(prev)->size + header(next)->size;
+
         // Coalesced free block starts at prev now
         current_block = prev;
     }
-    // Add coalesced block to beginning of free list
+
+    set_free(current_block, ALIGN(current_payload_size));
+
+    // Add coalesced block to beginning of its free list
     add_merge_block_to_freelist(current_block);
+
+    // The blocks merged away are no longer blocks of their own
+    if (!next_alloc) {
+        touch_merge(next, current_block);
+    }
+    if (!prev_alloc) {
+        touch_merge(freed, current_block);
+    }
+    touch(current_block);
     
     return current_block;
 }
 /*
- * mm_realloc - Naive implementation of realloc
+ * mm_realloc - Resize the block at ptr, in place whenever possible.
+ *
+ * A block that shrinks is split and its tail freed. A block that grows first
+ * absorbs its successor if that is free and large enough, and if it is the
+ * last block in the heap (possibly after a free successor), the heap is
+ * extended under it. Only when neither works is the data copied into a new
+ * block.
  */
 void *mm_realloc(void *ptr, size_t size)
 {
     size_t oldsize;
     void *newptr;
 
+    STAT_INC(realloc_calls);
+
     /* If size == 0 then this is just free, and we return NULL. */
     if(size == 0) {
         mm_free(ptr);
@@ -434,6 +1282,25 @@ void *mm_realloc(void *ptr, size_t size)
         return mm_malloc(size);
     }
 
+    if (header(ptr)->mmapped) {
+        // A mapped block that stays huge is remapped, one that shrinks
+        // below the threshold moves to the heap
+        if (size >= MMAP_THRESHOLD) {
+            return mmap_realloc(ptr, size);
+        }
+    } else if (size < MMAP_THRESHOLD) {
+#ifdef THREAD_SAFE
+        pthread_mutex_lock(&heap_lock);
+        newptr = realloc_in_place(ptr, adjust_size(size));
+        pthread_mutex_unlock(&heap_lock);
+#else
+        newptr = realloc_in_place(ptr, adjust_size(size));
+#endif
+        if (newptr) {
+            return newptr;
+        }
+    }
+
     newptr = mm_malloc(size);
 
     /* If realloc() fails the original block is left untouched  */
@@ -441,8 +1308,12 @@ void *mm_realloc(void *ptr, size_t size)
         return 0;
     }
 
-    /* Copy the old data. */
-    oldsize = header(ptr)->size;
+    /* Copy the old data, the payload excludes the header and footer. */
+    if (header(ptr)->mmapped) {
+        oldsize = header(ptr)->size - DWORD_SIZE;
+    } else {
+        oldsize = header(ptr)->size - ALLOC_OVERHEAD;
+    }
     if(size < oldsize) oldsize = size;
     memcpy(newptr, ptr, oldsize);
 
@@ -452,12 +1323,145 @@ void *mm_realloc(void *ptr, size_t size)
     return newptr;
 }
 
+/*
+ * realloc_in_place - Try to resize the allocated block at bp to asize bytes
+ * without moving it. Returns bp on success and NULL if the block has to move.
+ */
+static void *realloc_in_place(void *bp, size_t asize)
+{
+    size_t oldsize = header(bp)->size;
+    size_t size = oldsize;
+    void *next = next_payload(bp);
+
+    if (asize <= size) {
+        split_allocated(bp, asize);
+        return bp;
+    }
+
+    // Absorb a free successor
+    if (!header(next)->allocated) {
+        size_t next_size = header(next)->size;
+
+        if (size + next_size < asize && header(next_payload(next))->size != 0) {
+            return NULL;
+        }
+        remove_from_freelist(next);
+        size += next_size;
+        set_allocated(bp, size);
+        touch_merge(next, bp);
+        next = next_payload(bp);
+    }
+
+    // The block now ends at the epilogue, so grow the heap under it
+    if (size < asize) {
+        size_t extendsize = (asize - size + chunk_size - 1) & ~(chunk_size - 1);
+
+        if (header(next)->size != 0 || extendsize > INT_MAX ||
+            mem_sbrk(extendsize) == (void *)-1) {
+            // Hand back a successor absorbed above
+            split_allocated(bp, oldsize);
+            return NULL;
+        }
+        size += extendsize;
+        header(bp)->size = size;
+
+        /* New epilogue header */
+        set_epilogue(next_payload(bp), 1);
+        set_allocated(bp, size);
+        touch(bp);
+    }
+
+    split_allocated(bp, asize);
+    return bp;
+}
+
+/*
+ * mmap_size - Length of the mapping for a mapped block of size payload bytes:
+ * the payload and the first two words, rounded up to a whole page.
+ */
+static inline size_t mmap_size(size_t size)
+{
+    return (size + DWORD_SIZE + CHUNKSIZE - 1) & ~(size_t)(CHUNKSIZE - 1);
+}
+
+/*
+ * mmap_malloc - Allocate a block of size bytes in a mapping of its own.
+ */
+static void *mmap_malloc(size_t size)
+{
+    size_t len = mmap_size(size);
+    char *base;
+
+    if ((base = mem_map(len)) == NULL) {
+        return NULL;
+    }
+    STAT_INC(mmaps);
+    header_t *hdr = (header_t *)(base + WSIZE);
+    hdr->size = len;
+    hdr->mmapped = 1;
+    hdr->allocated = 1;
+    return hdr->payload;
+}
+
+/*
+ * mmap_realloc - Resize the mapped block at bp to size bytes with mremap.
+ * Returns the new payload, or NULL with bp untouched.
+ */
+static void *mmap_realloc(void *bp, size_t size)
+{
+    size_t len = mmap_size(size);
+    char *base;
+
+    if (len == header(bp)->size) {
+        return bp;
+    }
+    if ((base = mem_remap((char *)bp - DWORD_SIZE, header(bp)->size, len)) == NULL) {
+        return NULL;
+    }
+    header_t *hdr = (header_t *)(base + WSIZE);
+    hdr->size = len;
+    return hdr->payload;
+}
+
+/*
+ * mmap_free - Unmap the mapped block at bp.
+ */
+static void mmap_free(void *bp)
+{
+    STAT_INC(munmaps);
+    mem_unmap((char *)bp - DWORD_SIZE, header(bp)->size);
+}
+
+/*
+ * split_allocated - Shrink the allocated block at bp to asize bytes, freeing
+ * the tail as a new block if it is at least the minimum block size.
+ */
+static void split_allocated(void *bp, size_t asize)
+{
+    size_t size = header(bp)->size;
+
+    if (size - asize < 2 * DWORD_SIZE) {
+        return;
+    }
+    STAT_INC(splits);
+    set_allocated(bp, asize);
+    touch(bp);
+    set_allocated(next_payload(bp), size - asize);
+    free_block(next_payload(bp));
+}
+
 /*
  * mm_checkheap - Check the heap for correctness
  */
 void mm_checkheap(int verbose)
 {
+#ifdef THREAD_SAFE
+    pthread_mutex_lock(&heap_lock);
     checkheap(verbose);
+    pthread_mutex_unlock(&heap_lock);
+#else
+    checkheap(verbose);
+#endif
 }
 
 /*
@@ -483,80 +1487,287 @@ static void *extend_heap(size_t words)
     
     if ((uintptr_t)(bp = mem_sbrk(size)) == -1)
         return NULL;
-    /* Initialize free block header/footer and the epilogue header */
-    header(bp)->size = size;        /* Free block header */
-    footer(bp)->size = size;
-    header(bp)->allocated = footer(bp)->allocated = 0;
-    
-    header(bp)->links.fprev =  header(bp)->links.fnext = header(bp);
+    STAT_INC(heap_extends);
+    STAT_ADD(heap_extend_bytes, size);
+    /* Initialize free block header/footer and the epilogue header. The old 
+     * epilogue header becomes the new block's header and keeps its prev_alloc. */
+    header(bp)->size = size;
    
      /* New epilogue header */
-    header(next_payload(bp))->size = 0;
-    header(next_payload(bp))->allocated = 1; 
+    set_epilogue(next_payload(bp), 0);
+    set_free(bp, size);
    
     /* Coalesce if the previous block was free */
     return coalesce(bp);
 }
 
 /*
- * place - Place block of asize bytes in front pf the explicit
- *  free list and split if remainder would be at least minimum block size
- *  this technique can sometimes introduce internal fragmentation.
- *  
+ * place - Place block of asize bytes at the start of the free block p, 
+ *  taking it off its free list, and split if remainder would be at least 
+ *  minimum block size. The remainder goes back on the free list for its
+ *  own size class; anything smaller stays in p as internal fragmentation.
  */
 static void place(void *p, size_t asize)
 {
     size_t current_size = header(p)->size;
 
-    // Get previous free block and next free payloads
-    void *fprev_p = prev_free_payload(p);
-    void *fnext_p = next_free_payload(p);
-  
+    remove_from_freelist(p);
+    touch(p);
+
     if ((current_size - asize) >= (2 * DWORD_SIZE)) {
+        STAT_INC(splits);
 
-        header(p)->size = asize;
-        footer(p)->size = asize;
-        header(p)->allocated = footer(p)->allocated = 1;
+        set_allocated(p, asize);
 
         // q is a new free block left over after placing p
         void *q = next_payload(p);
-        header(q)->size = current_size - asize;
-        footer(q)->size = current_size - asize;
-        header(q)->allocated = footer(q)->allocated = 0;
-        //coalesce(q);
-
-        // Add q to the free list in p's place
-        header(fnext_p)->links.fprev = header(fprev_p)->links.fnext = header(q);
-        header(q)->links.fprev = header(fprev_p);
-        header(q)->links.fnext = header(fnext_p);
+        set_free(q, current_size - asize);
    
         coalesce(q);
     } else {
-        // There was no leftover, simply remove p from the free list
-        header(fnext_p)->links.fprev = header(fprev_p);
-        header(fprev_p)->links.fnext = header(fnext_p);
-        header(p)->allocated = footer(p)->allocated = 1;
-        remove_from_freelist(p);
-       
+        // There was no leftover, p is used as is
+        set_allocated(p, current_size);
     }
 }
+
 /*
- * find_fit - Find a fit for a block with asize bytes, this function searches the free list
- by looking at the next and previous free payload
+ * find_fit - Find a fit for a block with asize bytes. The search starts at
+ * the list for the size class of asize and moves up to larger classes, taking
+ * the first block that is big enough. With a single class this is a plain
+ * first-fit walk of the whole free list.
+ *
+ * Next fit walks each list once around from its rover, and leaves the rover
+ * on the block it returns, so place() moves it on to that block's successor.
+ * Best fit keeps walking until it has seen best_fit_candidates blocks that
+ * fit, or an exact fit, and returns the smallest.
  */
+static void *find_fit(size_t asize)
+{
+    void *p, *best = NULL;
+    int candidates = 0;
 
+    fit_searches++;
+    if (in_tree(asize)) {
+        return tree_fit(asize);
+    }
+    for (int class = size_class(asize); class < NUM_SIZE_CLASSES; class++) {
+        void *list = free_lists[class].payload;
+
+        if (fit_policy == MM_NEXT_FIT) {
+            void *start = rovers[class]->payload;
+
+            p = start;
+            do {
+                if (p != list) {
+                    fit_blocks_scanned++;
+                    if (asize <= header(p)->size) {
+                        rovers[class] = header(p);
+                        return p;
+                    }
+                }
+                p = next_free_payload(p);
+            } while (p != start);
+            continue;
+        }
 
-static void *find_fit(size_t asize)
+        for (p = next_free_payload(list); p != list; p = next_free_payload(p)) {
+            fit_blocks_scanned++;
+            if (asize <= header(p)->size) {
+                if (fit_policy == MM_FIRST_FIT || header(p)->size == asize) {
+                    return p;
+                }
+                if (best == NULL || header(p)->size < header(best)->size) {
+                    best = p;
+                }
+                if (++candidates == best_fit_candidates) {
+                    return best;
+                }
+            }
+        }
+        // Blocks in larger classes are all bigger than one found here
+        if (best) {
+            return best;
+        }
+    }
+    // Every block in the size tree is larger than any on the lists
+    return tree_fit(asize);
+}
+
+/*
+ * tree_fit - Best fit from the size tree: the smallest block of at least
+ * asize bytes, or NULL.
+ */
+static void *tree_fit(size_t asize)
 {
-    /* First-fit search */
-    void *p;
-    for (p = next_free_payload(heap_listp); p != heap_listp;
-         p = next_free_payload(p)) {
-        if (asize <= header(p)->size) {
-            return p;
+    header_t *node = tree_root, *best = NULL;
+
+    while (node) {
+        fit_blocks_scanned++;
+        if (node->size >= asize) {
+            best = node;
+            node = node->tree.left;
+        } else {
+            node = node->tree.right;
+        }
+    }
+    return best ? best->payload : NULL;
+}
+
+/*
+ * tree_stats - Adds the blocks in the subtree at `node` to `stats`.
+ */
+static void tree_stats(header_t *node, struct mm_fit_stats *stats)
+{
+    for (; node; node = node->tree.right) {
+        tree_stats(node->tree.left, stats);
+        stats->free_blocks++;
+        stats->free_bytes += node->size;
+        if (node->size > stats->largest_free) {
+            stats->largest_free = node->size;
         }
     }
-    return NULL;
+}
+
+/*
+ * mm_get_fit_stats - Report find_fit search lengths since init, and the
+ * free blocks on the free lists right now. Blocks held in per-thread caches
+ * or on quick lists count as allocated.
+ */
+void mm_get_fit_stats(struct mm_fit_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+#ifdef THREAD_SAFE
+    pthread_mutex_lock(&heap_lock);
+#endif
+    stats->searches = fit_searches;
+    stats->blocks_scanned = fit_blocks_scanned;
+    stats->misses = fit_misses;
+    for (int class = 0; heap_listp && class < NUM_SIZE_CLASSES; class++) {
+        void *list = free_lists[class].payload;
+
+        for (void *p = next_free_payload(list); p != list; p = next_free_payload(p)) {
+            stats->free_blocks++;
+            stats->free_bytes += header(p)->size;
+            if (header(p)->size > stats->largest_free) {
+                stats->largest_free = header(p)->size;
+            }
+        }
+    }
+    tree_stats(tree_root, stats);
+#ifdef THREAD_SAFE
+    pthread_mutex_unlock(&heap_lock);
+#endif
+}
+
+/*
+ * stats_tick - Count a call to mm_malloc, and print the counters every
+ * stats_interval calls. Does nothing in builds without MM_STATS.
+ */
+static inline void stats_tick(void)
+{
+#ifdef MM_STATS
+    STAT_INC(malloc_calls);
+    if (stats_interval && counters.malloc_calls % stats_interval == 0) {
+        stats_print_counters(stderr, &counters);
+    }
+#endif
+}
+
+/*
+ * stats_bucket - Histogram bucket of a block of `size` bytes
+ */
+static inline int stats_bucket(size_t size)
+{
+    int bucket = floor_log2(size) - MIN_BLOCK_LOG2;
+
+    if (bucket < 0) {
+        return 0;
+    }
+    return (bucket < MM_STATS_BUCKETS) ? bucket : MM_STATS_BUCKETS - 1;
+}
+
+/*
+ * stats_print_counters - Print the event counters of `stats` on one line
+ */
+static void stats_print_counters(FILE *fp, struct mm_stats *stats)
+{
+    fprintf(fp, "mm_stats: malloc %zu free %zu realloc %zu | fit %zu scanned %zu | "
+            "coalesce %zu/%zu/%zu/%zu split %zu | quick %zu consolidate %zu | "
+            "extend %zu (%zu bytes) | mmap %zu munmap %zu\n",
+            stats->malloc_calls, stats->free_calls, stats->realloc_calls,
+            stats->fit_searches, stats->fit_blocks_scanned,
+            stats->coalesce[0], stats->coalesce[1], stats->coalesce[2], stats->coalesce[3],
+            stats->splits, stats->quick_hits, stats->consolidations, stats->heap_extends, stats->heap_extend_bytes,
+            stats->mmaps, stats->munmaps);
+}
+
+/*
+ * mm_stats - Copy the counters into `stats` and fill in the histogram of
+ * live and free heap blocks. Blocks in per-thread caches or on quick lists
+ * count as live.
+ * Returns 0, or -1 with `stats` zeroed in builds without MM_STATS.
+ */
+int mm_stats(struct mm_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+#ifdef MM_STATS
+#ifdef THREAD_SAFE
+    pthread_mutex_lock(&heap_lock);
+#endif
+    *stats = counters;
+    stats->fit_searches = fit_searches;
+    stats->fit_blocks_scanned = fit_blocks_scanned;
+    for (char *bp = heap_listp; bp && header(bp)->size > 0; bp = next_payload(bp)) {
+        // The prologue is not a block anyone asked for
+        if (bp == heap_listp) {
+            continue;
+        }
+        if (header(bp)->allocated) {
+            stats->live_blocks[stats_bucket(header(bp)->size)]++;
+        } else {
+            stats->free_blocks[stats_bucket(header(bp)->size)]++;
+        }
+    }
+#ifdef THREAD_SAFE
+    pthread_mutex_unlock(&heap_lock);
+#endif
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/*
+ * mm_stats_dump - Print the counters and the block size histogram to `fp`.
+ * Prints nothing in builds without MM_STATS.
+ */
+void mm_stats_dump(FILE *fp)
+{
+    struct mm_stats stats;
+
+    if (mm_stats(&stats) < 0) {
+        return;
+    }
+    stats_print_counters(fp, &stats);
+    fprintf(fp, "mm_stats: %12s %10s %10s\n", "block bytes", "live", "free");
+    for (int i = 0; i < MM_STATS_BUCKETS; i++) {
+        if (stats.live_blocks[i] || stats.free_blocks[i]) {
+            fprintf(fp, "mm_stats: %11lu%s %10zu %10zu\n", 1UL << (i + MIN_BLOCK_LOG2),
+                    i == MM_STATS_BUCKETS - 1 ? "+" : " ",
+                    stats.live_blocks[i], stats.free_blocks[i]);
+        }
+    }
+}
+
+/*
+ * mm_stats_interval - Print the counters to stderr every `calls` calls to
+ * mm_malloc, or never if `calls` is 0. Only MM_STATS builds print.
+ */
+void mm_stats_interval(size_t calls)
+{
+#ifdef MM_STATS
+    stats_interval = calls;
+#endif
 }
 
 static void printblock(void *p)
@@ -581,7 +1792,11 @@ static void printblock(void *p)
         return;
     }
 
-    if (plinks) {
+    if (!halloc && in_tree(hsize)) {
+        printf("%p: header: [%lu:%c] tree {%p|%p} footer: [%lu:%c]\n", p,
+               hsize, 'f', (void *)header(p)->tree.left, (void *)header(p)->tree.right,
+               fsize, (falloc ? 'a' : 'f'));
+    } else if (plinks) {
         printf("%p: header: [%lu:%c] {%p|%p} footer: [%lu:%c]\n", p,
             hsize, (halloc ? 'a' : 'f'),
                header(p)->links.fprev->payload,
@@ -589,111 +1804,438 @@ static void printblock(void *p)
                fsize, (falloc ? 'a' : 'f'));
 
     } else {
+#ifdef FOOTER_ELISION
+        // Allocated blocks have no footer, the last word is payload
+        printf("%p: header: [%lu:%c] {}\n", p, hsize, (halloc ? 'a' : 'f'));
+#else
         printf("%p: header: [%lu:%c] {} footer: [%lu:%c]\n", p,
                hsize, (halloc ? 'a' : 'f'),
                fsize, (falloc ? 'a' : 'f'));
+#endif
+    }
+}
+
+/*
+ * Heap validation
+ *
+ * mm_validate checks the heap and reports what it finds in an array of
+ * struct mm_error instead of printing or exiting, so it can run inside a
+ * live program. A full check walks the heap once, setting a bit for every
+ * free block in `check_bitmap` (one bit per 16 bytes of heap), then walks
+ * the free lists and the size tree once, clearing the bit of each entry.
+ * An entry whose bit is already clear is not a free block of the heap or
+ * is listed twice, and a bit still set at the end is a free block that is
+ * on no list.
+ *
+ * MM_VALIDATE builds also remember up to TOUCH_MAX blocks that place,
+ * coalesce and realloc have changed since the last check. A touched check
+ * looks only at those blocks and their neighbours. When more blocks were
+ * touched than fit, it does a full check instead.
+ */
+#define TOUCH_MAX 64
+
+struct check {
+    struct mm_error *errors;
+    int max_errors;
+    int count;
+};
+
+static uint64_t *check_bitmap;
+static size_t check_bitmap_bytes;
+
+#ifdef MM_VALIDATE
+static void *touched[TOUCH_MAX];
+static int num_touched;
+static int touch_overflow;
+#endif
+
+/*
+ * report - Record an error about the block at bp
+ */
+static void report(struct check *c, enum mm_error_kind kind, void *bp)
+{
+    if (c->count < c->max_errors) {
+        c->errors[c->count].kind = kind;
+        c->errors[c->count].block = bp;
     }
+    c->count++;
 }
 
-static void checkblock(void *bp)
+/*
+ * touch - Remember that the block at bp changed (MM_VALIDATE builds)
+ */
+static inline void touch(void *bp)
 {
-   if ((char *)bp < heap_listp) {
-    printf("Error: Out-of-bounds access at %p\n", bp);
-    return;
+#ifdef MM_VALIDATE
+    for (int i = 0; i < num_touched; i++) {
+        if (touched[i] == bp) {
+            return;
+        }
+    }
+    if (num_touched < TOUCH_MAX) {
+        touched[num_touched++] = bp;
+    } else {
+        touch_overflow = 1;
+    }
+#endif
 }
-    if ((size_t)bp % DWORD_SIZE != 0)
-        printf("Error: %p is not doubleword aligned\n", bp);
 
-    if (header(bp)->size != footer(bp)->size)
-        printf("Error: header does not match footer\n");
-        
+/*
+ * touch_merge - The block at `gone` is now part of the block at `bp`, so
+ * stop tracking it as a block of its own (MM_VALIDATE builds)
+ */
+static inline void touch_merge(void *gone, void *bp)
+{
+#ifdef MM_VALIDATE
+    for (int i = 0; i < num_touched; i++) {
+        if (touched[i] == gone) {
+            touched[i] = touched[--num_touched];
+            break;
+        }
+    }
+    touch(bp);
+#endif
+}
 
-    if (header(bp)->allocated == 1 && footer(bp)->allocated == 0)
-        printf("Error: header cannot be allocated and footer free or vice versa\n");
+/*
+ * touch_trim - The heap now ends at `top`, so forget the blocks above it
+ * (MM_VALIDATE builds)
+ */
+static inline void touch_trim(void *top)
+{
+#ifdef MM_VALIDATE
+    for (int i = 0; i < num_touched; ) {
+        if ((char *)touched[i] >= (char *)top) {
+            touched[i] = touched[--num_touched];
+        } else {
+            i++;
+        }
+    }
+#endif
 }
 
+/*
+ * touch_reset - Forget all touched blocks
+ */
+static inline void touch_reset(void)
+{
+#ifdef MM_VALIDATE
+    num_touched = 0;
+    touch_overflow = 0;
+#endif
+}
 
 /*
- * checkheap - Minimal check of the heap for consistency
+ * check_block - Check the block at bp, which lies in the heap below `end`,
+ * on its own and against its neighbours. Returns 0 if the block is too
+ * broken to find the next one.
  */
-void checkheaps(int verbose)
+static int check_block(void *bp, char *end, struct check *c)
 {
-    char *bp = heap_listp;
-  
-    if (verbose)
-        printf("Heap (%p):\n", heap_listp);
+    size_t size = header(bp)->size;
+    void *next;
 
-    if (header(heap_listp)->size != DWORD_SIZE || 
-    header(heap_listp)->allocated == 0) {
-        printf("Bad prologue header\n");
-     checkblock(heap_listp);
+    if ((uintptr_t)bp % DWORD_SIZE != 0) {
+        report(c, MM_MISALIGNED, bp);
+        return 0;
     }
-     if (footer(heap_listp)->size != DWORD_SIZE || 
-    footer(heap_listp)->allocated == 0) {
-        printf("Bad prologue header\n");
-     checkblock(heap_listp);
+    if (size < 2 * DWORD_SIZE || size % DWORD_SIZE != 0 || size > (size_t)(end - (char *)bp)) {
+        report(c, MM_BAD_SIZE, bp);
+        return 0;
     }
-    
-    for (bp = heap_listp; header(bp)->size > 0; bp = next_payload(bp)) {
-        if (verbose)
-            printblock(bp);
-        checkblock(bp);
+    next = next_payload(bp);
+
+#ifdef FOOTER_ELISION
+    if (header(next)->prev_alloc != header(bp)->allocated) {
+        report(c, MM_BAD_PREV_ALLOC, next);
+    }
+    // Only free blocks carry a footer
+    if (header(bp)->allocated) {
+        return 1;
+    }
+#endif
+    if (footer(bp)->size != size || footer(bp)->allocated != header(bp)->allocated) {
+        report(c, MM_HEADER_FOOTER_MISMATCH, bp);
+    }
+    if (!header(bp)->allocated && !header(next)->allocated) {
+        report(c, MM_UNCOALESCED, bp);
+    }
+    return 1;
+}
+
+#ifdef MM_VALIDATE
+/*
+ * tree_contains - Returns whether the block at `node` is in the size tree
+ */
+static int tree_contains(header_t *node)
+{
+    header_t *p = tree_root;
+
+    while (p && p != node) {
+        p = tree_less(node, p) ? p->tree.left : p->tree.right;
     }
+    return p != NULL;
+}
+
+/*
+ * check_free_links - Check that the free block at bp is on a free list of
+ * the right class, or in the size tree
+ */
+static void check_free_links(void *bp, struct check *c)
+{
+    header_t *hdr = header(bp);
 
-    if (verbose)
-        printblock(bp);
-    //epilogue header
-    if (header(bp)->size != 0 || header(bp)->allocated == 0)
-        printf("Bad epilogue header\n");
+    if (in_tree(hdr->size)) {
+        if (!tree_contains(hdr)) {
+            report(c, MM_NOT_ON_FREE_LIST, bp);
+        }
+        return;
+    }
+    if (hdr->links.fnext->links.fprev != hdr || hdr->links.fprev->links.fnext != hdr) {
+        report(c, MM_BAD_LINKS, bp);
+    }
 }
+#endif
+
 /*
- * checkheap - Minimal check of the heap for consistency
+ * mark_free - Clear the bitmap bit of free list or tree entry bp, checking
+ * that it is a free heap block that has not been seen yet
  */
-void checkheap(int verbose)
+static int mark_free(void *bp, char *end, struct check *c)
 {
-    void *p = heap_listp;
+    size_t bit = ((char *)bp - heap_listp) / DWORD_SIZE;
 
-    if (verbose) {
-        printf("Heap (%p):\n", heap_listp);
+    if ((char *)bp <= heap_listp || (char *)bp >= end || (uintptr_t)bp % DWORD_SIZE) {
+        report(c, MM_OUT_OF_HEAP, bp);
+        return 0;
+    }
+    if (header(bp)->allocated) {
+        report(c, MM_FREE_LIST_ALLOCATED, bp);
+        return 1;
+    }
+    if (!(check_bitmap[bit / 64] & (1ULL << (bit % 64)))) {
+        // Not a block the heap walk found free, or listed twice
+        report(c, MM_BAD_LINKS, bp);
+        return 0;
     }
+    check_bitmap[bit / 64] &= ~(1ULL << (bit % 64));
+    return 1;
+}
 
-    // Check prologue
-    if (header(heap_listp)->size != 2 * DWORD_SIZE ||
-        header(heap_listp)->allocated == 0) {
-        printf("Bad prologue header\n");
-        exit(1);
+/*
+ * check_tree - Check the size tree below `node`: blocks in order between
+ * `lo` and `hi` (either may be NULL), no child outranking its parent, and
+ * every node a free heap block. `budget` bounds the nodes visited, so a
+ * cycle cannot recurse forever.
+ */
+static void check_tree(header_t *node, header_t *lo, header_t *hi, char *end,
+                       size_t *budget, struct check *c)
+{
+    if (node == NULL) {
+        return;
+    }
+    if ((*budget)-- == 0 || !mark_free(node->payload, end, c)) {
+        report(c, MM_BAD_TREE, node->payload);
+        return;
+    }
+    if (!in_tree(node->size) || (lo && !tree_less(lo, node)) || (hi && !tree_less(node, hi)) ||
+        (node->tree.left && tree_priority(node->tree.left) > tree_priority(node)) ||
+        (node->tree.right && tree_priority(node->tree.right) > tree_priority(node))) {
+        report(c, MM_BAD_TREE, node->payload);
     }
-    checkblock(heap_listp);
+    check_tree(node->tree.left, lo, node, end, budget, c);
+    check_tree(node->tree.right, node, hi, end, budget, c);
+}
 
-    // Check all blocks
-    for (p = heap_listp; header(p)->size > 0; p = (void*)next_payload(p)) {
-        if (verbose) {
-            printblock(p);
+/*
+ * check_full - One heap walk, then one walk of the free lists and tree
+ */
+static void check_full(struct check *c)
+{
+    char *end = mem_sbrk(0);
+    size_t bits = (end - heap_listp) / DWORD_SIZE;
+    size_t words = (bits + 63) / 64;
+    size_t free_blocks = 0;
+    void *bp;
+
+    if (header(heap_listp)->size != 2 * DWORD_SIZE || !header(heap_listp)->allocated) {
+        report(c, MM_BAD_PROLOGUE, heap_listp);
+        return;
+    }
+
+    // The bitmap is kept between checks and grows with the heap
+    if (words * sizeof(uint64_t) > check_bitmap_bytes) {
+        size_t len = (words * sizeof(uint64_t) + CHUNKSIZE - 1) & ~(size_t)(CHUNKSIZE - 1);
+        void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (p == MAP_FAILED) {
+            report(c, MM_NO_MEMORY, NULL);
+            return;
         }
-        checkblock(p);
+        if (check_bitmap) {
+            munmap(check_bitmap, check_bitmap_bytes);
+        }
+        check_bitmap = p;
+        check_bitmap_bytes = len;
     }
+    memset(check_bitmap, 0, words * sizeof(uint64_t));
 
-    // Check epilogue
-    if (verbose) {
-        printblock(p);
+    for (bp = next_payload(heap_listp); (char *)bp < end && header(bp)->size > 0; bp = next_payload(bp)) {
+        if (!check_block(bp, end, c)) {
+            return;
+        }
+        if (!header(bp)->allocated) {
+            size_t bit = ((char *)bp - heap_listp) / DWORD_SIZE;
+            check_bitmap[bit / 64] |= 1ULL << (bit % 64);
+            free_blocks++;
+        }
     }
-    if (header(p)->size != 0 || header(p)->allocated == 0) {
-        printf("Bad epilogue header\n");
-        exit(1);
+    if (bp != end || header(bp)->size != 0 || !header(bp)->allocated) {
+        report(c, MM_BAD_EPILOGUE, bp);
+        return;
     }
 
-    // Check free list consistency
-    for (p = next_free_payload(heap_listp); p != heap_listp;
-         p = next_free_payload(p)) {
-        if (header(p)->allocated) {
-            printf("Free block marked as allocated: %p\n", p);
-            exit(1);
+    for (int class = 0; class < NUM_SIZE_CLASSES; class++) {
+        header_t *list = &free_lists[class];
+        size_t budget = free_blocks;
+
+        for (header_t *hdr = list->links.fnext; hdr != list; hdr = hdr->links.fnext) {
+            if (budget-- == 0 || !mark_free(hdr->payload, end, c)) {
+                // A cycle, or a link leading out of the heap
+                report(c, MM_BAD_LINKS, hdr->payload);
+                break;
+            }
+            if (hdr->links.fnext->links.fprev != hdr) {
+                report(c, MM_BAD_LINKS, hdr->payload);
+                break;
+            }
+            if (size_class(hdr->size) != class || in_tree(hdr->size)) {
+                report(c, MM_WRONG_CLASS, hdr->payload);
+            }
         }
+    }
+    size_t budget = free_blocks;
+    check_tree(tree_root, NULL, NULL, end, &budget, c);
+
+    // Free blocks no list or tree entry accounted for
+    for (size_t w = 0; w < words; w++) {
+        for (uint64_t bitsleft = check_bitmap[w]; bitsleft; bitsleft &= bitsleft - 1) {
+            size_t bit = w * 64 + __builtin_ctzll(bitsleft);
+            report(c, MM_NOT_ON_FREE_LIST, heap_listp + bit * DWORD_SIZE);
+        }
+    }
+}
+
+/*
+ * check_touched - Check only the blocks touched since the last check
+ */
+#ifdef MM_VALIDATE
+static void check_touched(struct check *c)
+{
+    char *end = mem_sbrk(0);
+
+    for (int i = 0; i < num_touched; i++) {
+        void *bp = touched[i];
+
+        // A block trimmed off the top of the heap is gone, and one
+        // below the start is left from a heap before the last re-init
+        if ((char *)bp < heap_listp || (char *)bp >= end) {
+            continue;
+        }
+        if (!check_block(bp, end, c)) {
+            continue;
+        }
+        if (!header(bp)->allocated) {
+            check_free_links(bp, c);
+        }
+        if (!prev_allocated(bp) && !header(bp)->allocated) {
+            report(c, MM_UNCOALESCED, prev_payload(bp));
+        }
+    }
+}
+#endif
+
+/*
+ * mm_validate - Check the heap without printing or exiting. MM_CHECK_FULL
+ * checks every block and every free list entry; MM_CHECK_TOUCHED checks
+ * only the blocks changed since the last check, in MM_VALIDATE builds.
+ * Up to max_errors problems are stored in `errors`. Returns the number of
+ * problems found, which may be more than were stored, so 0 means the heap
+ * looks good.
+ */
+int mm_validate(enum mm_check_mode mode, struct mm_error *errors, int max_errors)
+{
+    struct check c = { errors, max_errors, 0 };
+
+#ifdef THREAD_SAFE
+    pthread_mutex_lock(&heap_lock);
+#endif
+    if (heap_listp != NULL) {
+#ifdef MM_VALIDATE
+        if (mode == MM_CHECK_TOUCHED && !touch_overflow) {
+            check_touched(&c);
+        } else {
+            check_full(&c);
+        }
+#else
+        check_full(&c);
+#endif
+        touch_reset();
+    }
+#ifdef THREAD_SAFE
+    pthread_mutex_unlock(&heap_lock);
+#endif
+    return c.count;
+}
 
-        if (header(p)->links.fnext->links.fprev != header(p) ||
-            header(p)->links.fprev->links.fnext != header(p)) {
-            printf("Free list pointers inconsistent: %p\n", p);
-            exit(1);
+/*
+ * mm_strerror - Describe a validation error
+ */
+const char *mm_strerror(enum mm_error_kind kind)
+{
+    switch (kind) {
+    case MM_BAD_PROLOGUE:           return "bad prologue block";
+    case MM_BAD_EPILOGUE:           return "bad epilogue header";
+    case MM_MISALIGNED:             return "block is not 16-byte aligned";
+    case MM_BAD_SIZE:               return "block size is invalid or runs past the heap";
+    case MM_HEADER_FOOTER_MISMATCH: return "header does not match footer";
+    case MM_BAD_PREV_ALLOC:         return "prev_alloc bit does not match the previous block";
+    case MM_UNCOALESCED:            return "free block next to another free block";
+    case MM_OUT_OF_HEAP:            return "free list entry outside the heap";
+    case MM_FREE_LIST_ALLOCATED:    return "free list entry is marked allocated";
+    case MM_BAD_LINKS:              return "free list links are inconsistent";
+    case MM_WRONG_CLASS:            return "free block in the wrong size class";
+    case MM_NOT_ON_FREE_LIST:       return "free block is on no free list";
+    case MM_BAD_TREE:               return "size tree is inconsistent";
+    case MM_NO_MEMORY:              return "no memory for the check";
+    }
+    return "unknown error";
+}
+
+/*
+ * checkheap - Print the heap if verbose, then check it and exit on error.
+ * The caller holds heap_lock in THREAD_SAFE builds.
+ */
+static void checkheap(int verbose)
+{
+    struct mm_error errors[16];
+    struct check c = { errors, 16, 0 };
+    void *p;
+
+    if (verbose) {
+        printf("Heap (%p):\n", heap_listp);
+        for (p = heap_listp; header(p)->size > 0; p = next_payload(p)) {
+            printblock(p);
         }
+        printblock(p);
+    }
+
+    check_full(&c);
+    touch_reset();
+    for (int i = 0; i < c.count && i < c.max_errors; i++) {
+        printf("%p: %s\n", errors[i].block, mm_strerror(errors[i].kind));
+    }
+    if (c.count > 0) {
+        exit(1);
     }
 }
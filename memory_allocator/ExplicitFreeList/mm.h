@@ -1,7 +1,90 @@
 #include <stddef.h>
+#include <stdio.h>
+
+/* Placement policies for mm_init_policy */
+enum mm_fit_policy {
+    MM_FIRST_FIT,   /* first block that fits, from the head of the list */
+    MM_NEXT_FIT,    /* first block that fits, from where the last search stopped */
+    MM_BEST_FIT,    /* smallest of the first N blocks that fit */
+};
+
+/* find_fit search lengths, and free space in the heap, see mm_get_fit_stats */
+struct mm_fit_stats {
+    size_t searches;        /* calls to find_fit */
+    size_t blocks_scanned;  /* free blocks looked at by those calls */
+    size_t misses;          /* searches that found nothing and grew the heap */
+    size_t free_blocks;     /* blocks on the free lists now */
+    size_t free_bytes;      /* bytes in those free blocks */
+    size_t largest_free;    /* size of the largest of them */
+};
+
+/*
+ * Buckets of the mm_stats block histogram: bucket i counts blocks of 2^(i+5)
+ * up to 2^(i+6) - 1 bytes, and the last bucket everything larger.
+ */
+#define MM_STATS_BUCKETS 20
+
+/* Allocator counters, kept only in MM_STATS builds, see mm_stats */
+struct mm_stats {
+    size_t malloc_calls;
+    size_t free_calls;
+    size_t realloc_calls;
+    size_t fit_searches;        /* calls to find_fit */
+    size_t fit_blocks_scanned;  /* free blocks looked at by those calls */
+    size_t coalesce[4];         /* coalesce cases: no free neighbour, next, prev, both */
+    size_t splits;              /* blocks split by place or a shrinking realloc */
+    size_t quick_hits;          /* requests served from a quick list (DEFERRED_COALESCE) */
+    size_t consolidations;      /* passes that coalesced the quick lists */
+    size_t heap_extends;        /* calls to extend_heap */
+    size_t heap_extend_bytes;   /* bytes they added to the heap */
+    size_t mmaps;               /* blocks given their own mapping */
+    size_t munmaps;             /* mapped blocks freed */
+    size_t live_blocks[MM_STATS_BUCKETS];  /* allocated heap blocks by size, now */
+    size_t free_blocks[MM_STATS_BUCKETS];  /* free heap blocks by size, now */
+};
+
+/* Problems mm_validate can report */
+enum mm_error_kind {
+    MM_BAD_PROLOGUE,
+    MM_BAD_EPILOGUE,
+    MM_MISALIGNED,
+    MM_BAD_SIZE,                /* too small, not a multiple of 16, or past the heap */
+    MM_HEADER_FOOTER_MISMATCH,
+    MM_BAD_PREV_ALLOC,
+    MM_UNCOALESCED,             /* two free blocks side by side */
+    MM_OUT_OF_HEAP,             /* free list entry outside the heap */
+    MM_FREE_LIST_ALLOCATED,     /* free list entry marked allocated */
+    MM_BAD_LINKS,               /* broken, cyclic or duplicate free list links */
+    MM_WRONG_CLASS,
+    MM_NOT_ON_FREE_LIST,        /* free block on no free list */
+    MM_BAD_TREE,
+    MM_NO_MEMORY,               /* the check itself could not get memory */
+};
+
+struct mm_error {
+    enum mm_error_kind kind;
+    void *block;                /* payload of the block at fault */
+};
+
+/* What mm_validate looks at */
+enum mm_check_mode {
+    MM_CHECK_FULL,              /* every block and free list entry */
+    MM_CHECK_TOUCHED,           /* blocks changed since the last check (MM_VALIDATE builds) */
+};
+
 extern void mm_init(void);
+extern void mm_init_policy(enum mm_fit_policy policy, int candidates);
 extern void mm_deinit(void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
+extern void mm_free_batch(void **ptrs, size_t n);
 extern void *mm_realloc(void *ptr, size_t size);
 extern void mm_checkheap(int verbose);
+extern int mm_validate(enum mm_check_mode mode, struct mm_error *errors, int max_errors);
+extern const char *mm_strerror(enum mm_error_kind kind);
+extern size_t mm_trim(void);
+extern size_t mm_bytes_returned(void);
+extern void mm_get_fit_stats(struct mm_fit_stats *stats);
+extern int mm_stats(struct mm_stats *stats);
+extern void mm_stats_dump(FILE *fp);
+extern void mm_stats_interval(size_t calls);
@@ -24,5 +24,6 @@ int main(int argc, char **argv)
     mm_checkheap(1);
     mm_free(q);
     mm_checkheap(1);
+    mm_stats_dump(stderr);
     mm_deinit();
 }
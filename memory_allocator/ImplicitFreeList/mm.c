@@ -5,6 +5,7 @@
 #include <assert.h>
 #include<inttypes.h>
 #include <stddef.h>
+#include <limits.h>
 
 #include "mm.h"
 #include "../libmem/mem.h"
@@ -14,7 +15,8 @@
  * Implicit Free List Memory Allocator
  * 
  * This implementation manages memory using an implicit free list with:
- * - First-fit placement strategy
+ * - First-fit placement by default, or next fit or bounded best fit chosen
+ *   with mm_init_policy
  * - Boundary tag coalescing for adjacent free blocks
  * - 16-byte alignment for payloads
  * - Minimum block size of 32 bytes (header, footer, and alignment padding)
@@ -23,36 +25,64 @@
  * - Header and footer include size (60 bits) and allocation status (1 bit).
  * - Blocks are coalesced when freed to reduce fragmentation.
  * - Memory is extended as needed using `mem_sbrk`.
+ * - Large free blocks and a large free block at the top of the heap are
+ *   given back to the OS.
+ * - With FOOTER_ELISION, allocated blocks drop their footer and the minimum
+ *   block shrinks to 16 bytes.
+ * - With MM_STATS, calls and allocator events are counted for mm_stats.
  */
 
 
 #define WSIZE       8       /* Word and header/footer size (bytes) */
 #define DWORD_SIZE  16      /* Double-word size (bytes) */
 #define CHUNKSIZE   4096    /* Extend heap by this amount (bytes) */
+#define RELEASE_THRESHOLD (64 * 1024)  /* madvise the pages of free blocks this large */
+#define TRIM_THRESHOLD   (128 * 1024)  /* shrink the heap when its top free block is this large */
+#define STATS_BUCKET_LOG2 5 /* log2 of the smallest mm_stats histogram bucket */
+
+/*
+ * Footer elision (FOOTER_ELISION builds). Only coalesce reads the previous
+ * block's footer, and only when that block is free, so allocated blocks skip
+ * the footer and each header's prev_alloc bit says whether the block before
+ * it is allocated. An allocated block then costs one word instead of two,
+ * and a free block only needs its header and footer, so the minimum block
+ * is 16 bytes.
+ */
+#ifdef FOOTER_ELISION
+#define ALLOC_OVERHEAD WSIZE
+#define MIN_BLOCK_SIZE DWORD_SIZE
+#else
+#define ALLOC_OVERHEAD DWORD_SIZE
+#define MIN_BLOCK_SIZE (2*DWORD_SIZE)
+#endif
 
 /*
  * Block Header and Footer Structures:
  * - `size`: Block size in bytes (60 bits).
+ * - `prev_alloc`: Allocation status of the previous block (1 bit, only
+ *   maintained in FOOTER_ELISION builds).
  * - `allocated`: Allocation status (1 bit: 0 = free, 1 = allocated).
  */
 typedef struct {
    // Note that this diverges from CSAPP's header semantics. Here, the size
    // field stores the full block size in bytes using 60 bits. This is more
    // than sufficient -- Linux uses 48 or 57 bits for virtual addresses. We do
-   // not use any part of those 60 bits to store the allocated bit. The three
-   // bits after size are reserved for future use and the last bit is the
-   // allocated bit.
-    uint64_t      size : 60;
-    uint64_t    unused :  3;
-    uint64_t allocated :  1;
+   // not use any part of those 60 bits to store the allocated bit. Of the
+   // three bits after size, two are reserved for future use and one holds
+   // prev_alloc. The last bit is the allocated bit.
+    uint64_t       size : 60;
+    uint64_t     unused :  2;
+    uint64_t prev_alloc :  1;
+    uint64_t  allocated :  1;
 
     char payload[];
 } header_t;
 
 typedef struct {
-    uint64_t      size : 60;
-    uint64_t    unused :  3;
-    uint64_t allocated :  1;
+    uint64_t       size : 60;
+    uint64_t     unused :  2;
+    uint64_t prev_alloc :  1;
+    uint64_t  allocated :  1;
 } footer_t;
 
 
@@ -92,15 +122,92 @@ static inline void *next_payload(void *payload) {
 
 /* The following function takes you to the previous payload in the heap */
 static inline void *prev_payload(void *payload) {
-    footer_t *prev_ftr = (footer_t *)((char *)header(payload) - DWORD_SIZE);
+    footer_t *prev_ftr = (footer_t *)((char *)header(payload) - WSIZE);
     size_t block_size = prev_ftr->size;
     char *p = (char *)payload - block_size;
     return p;
 }
 
+/*
+ * prev_allocated: Returns whether the block before `payload` is allocated.
+ * Without a footer to read, FOOTER_ELISION builds keep this in the header.
+ */
+static inline int prev_allocated(void *payload) {
+#ifdef FOOTER_ELISION
+    return header(payload)->prev_alloc;
+#else
+    return footer(prev_payload(payload))->allocated;
+#endif
+}
+
+/*
+ * set_allocated: Marks the block at `payload` allocated with `size` bytes.
+ */
+static inline void set_allocated(void *payload, size_t size) {
+    header(payload)->size = size;
+    header(payload)->unused = 0;
+    header(payload)->allocated = 1;
+#ifdef FOOTER_ELISION
+    header(next_payload(payload))->prev_alloc = 1;
+#else
+    footer(payload)->size = size;
+    footer(payload)->allocated = 1;
+#endif
+}
+
+/*
+ * set_free: Marks the block at `payload` free with `size` bytes.
+ */
+static inline void set_free(void *payload, size_t size) {
+    header(payload)->size = size;
+    header(payload)->unused = 0;
+    header(payload)->allocated = 0;
+    footer(payload)->size = size;
+    footer(payload)->allocated = 0;
+#ifdef FOOTER_ELISION
+    header(next_payload(payload))->prev_alloc = 0;
+#endif
+}
+
+/*
+ * set_epilogue: Writes the zero-size allocated header that ends the heap.
+ */
+static inline void set_epilogue(void *payload, int prev_alloc) {
+    header(payload)->size = 0;
+    header(payload)->unused = 0;
+    header(payload)->prev_alloc = prev_alloc;
+    header(payload)->allocated = 1;
+}
+
 /* Global pointer to the start of the heap */
 static char *heap_listp = 0;  
 
+/*
+ * Placement policy. Next fit resumes the search at `rover`, the block after
+ * the last fit, instead of at the start of the heap. Best fit looks at up
+ * to best_fit_candidates free blocks that fit (all of them if <= 0) and
+ * takes the smallest.
+ */
+static enum mm_fit_policy fit_policy = MM_FIRST_FIT;
+static int best_fit_candidates = 0;
+static char *rover = 0;
+
+/* find_fit counters for mm_get_fit_stats */
+static size_t fit_searches, fit_blocks_scanned, fit_misses;
+
+/*
+ * Statistics (MM_STATS builds). STAT_INC and STAT_ADD bump a field of
+ * `counters` and compile to nothing otherwise.
+ */
+#ifdef MM_STATS
+static struct mm_stats counters;
+static size_t stats_interval;
+#define STAT_ADD(field, n) (counters.field += (n))
+#else
+#define STAT_ADD(field, n) ((void)0)
+#endif
+#define STAT_INC(field) STAT_ADD(field, 1)
+
 /* Function prototypes for internal helper routines */
 static void *extend_heap(size_t words);
 static void place(void *bp, size_t asize);
@@ -109,12 +216,35 @@ static void *coalesce(void *bp);
 static void printblock(void *bp);
 static void checkheap(int verbose);
 static void checkblock(void *bp);
+static void free_block(void *bp);
+static size_t trim_heap(size_t threshold);
+static void *realloc_in_place(void *bp, size_t asize);
+static void split_allocated(void *bp, size_t asize);
+static inline void fix_rover(void *bp);
+static inline void stats_tick(void);
+static void stats_print_counters(FILE *fp, struct mm_stats *stats);
 
 /*
- * mm_init - Initialize the memory manager
+ * mm_init - Initialize the memory manager with first-fit placement
  */
 void mm_init(void)
 {
+    mm_init_policy(MM_FIRST_FIT, 0);
+}
+
+/*
+ * mm_init_policy - Initialize the memory manager with the given placement
+ * policy. `candidates` bounds the number of fitting blocks MM_BEST_FIT
+ * compares, and is ignored by the other policies.
+ */
+void mm_init_policy(enum mm_fit_policy policy, int candidates)
+{
+    fit_policy = policy;
+    best_fit_candidates = candidates;
+    fit_searches = fit_blocks_scanned = fit_misses = 0;
+#ifdef MM_STATS
+    memset(&counters, 0, sizeof(counters));
+#endif
 
     assert(sizeof(header_t) == WSIZE);
 
@@ -132,13 +262,18 @@ void mm_init(void)
       // 8-byte leading padding
     memset(heap_listp, 0, WSIZE);
 
+#ifdef DEBUG
     printf("heap list current address: %p bytes\n", heap_listp);
+#endif
 
     // a bug is detected in the mm_init logic for the prologue and epilogue block address
     heap_listp += DWORD_SIZE;
     header(heap_listp)->size = DWORD_SIZE;
+    header(heap_listp)->prev_alloc = 1;
     header(heap_listp)->allocated = 1;
+#ifdef DEBUG
     printf("Prologue header address: %p\n", header(heap_listp));
+#endif
     
     // My understanding is that the pointer should be incremented by a word size
     //for the prologue header and a word size for the prologue footer
@@ -146,19 +281,23 @@ void mm_init(void)
     heap_listp += DWORD_SIZE;
     footer(heap_listp)->size = DWORD_SIZE;
     footer(heap_listp)->allocated = 1;
+#ifdef DEBUG
     printf("Prologue footer address: %p\n", footer(heap_listp));
+#endif
 
     // Initialize epilogue
     //epilogue header sometimes has alignment issues that could be from the coalesce function
     // or the extend heap.
     //the epilogue should be at the end of the heap,
-    header(heap_listp);
-    header(heap_listp)->size = 0;
-    header(heap_listp)->allocated = 1;
+    set_epilogue(heap_listp, 1);
+#ifdef DEBUG
     printf("epilogue header address: %p\n", heap_listp);
+#endif
     heap_listp -= DWORD_SIZE;
 
 
+    rover = heap_listp;
+
     /* Extend the empty heap with a free block of CHUNKSIZE bytes */
     if (extend_heap(CHUNKSIZE/WSIZE) == NULL) {
         perror("extend_heap");
@@ -171,6 +310,16 @@ void mm_deinit(void)
     mem_deinit();
 }
 
+/*
+ * adjust_size - Adjust block size to include overhead and alignment reqs.
+ */
+static inline size_t adjust_size(size_t size)
+{
+    if (size + ALLOC_OVERHEAD <= MIN_BLOCK_SIZE)
+        return MIN_BLOCK_SIZE;
+    return DWORD_SIZE * ((size + (ALLOC_OVERHEAD) + (DWORD_SIZE-1)) / DWORD_SIZE);
+}
+
 /*
  * mm_malloc - Allocate a block with at least size bytes of payload
  */
@@ -183,15 +332,13 @@ void *mm_malloc(size_t size)
     if (heap_listp == 0){
         mm_init();
     }
+    stats_tick();
+
     /* Ignore spurious requests */
     if (size <=  0)
         return NULL;
 
-    /* Adjust block size to include overhead and alignment reqs. */
-    if (size <= DWORD_SIZE)
-        asize = 2*DWORD_SIZE;
-    else
-        asize = DWORD_SIZE * ((size + (DWORD_SIZE) + (DWORD_SIZE-1)) / DWORD_SIZE);
+    asize = adjust_size(size);
 
     /* Search the free list for a fit */
     if ((bp = find_fit(asize)) != NULL) {
@@ -200,6 +347,7 @@ void *mm_malloc(size_t size)
     }
 
     /* No fit found. Get more memory and place the block */
+    fit_misses++;
     extendsize = MAX(asize,CHUNKSIZE);
     if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
         return NULL;
@@ -215,22 +363,127 @@ void mm_free(void *bp)
 
     if (bp == 0)
         return;
+    STAT_INC(free_calls);
 
     size_t block_size = header(bp)->size;
     if (heap_listp == 0){
         mm_init();
     }
    
-    // free the header block with size intact, block is mark as free in header
-    header(bp)->size = block_size;
-    header(bp)->allocated = 0;
-
-    // free the footer block with size intact
-    footer(bp)->size = block_size;
-    footer(bp)->allocated = 0;
+    // free the header and footer with size intact, block is mark as free
+    set_free(bp, block_size);
     
     // merge adjacent blocks into larger blocks to prevent external fragmentation
-    coalesce(bp);
+    free_block(bp);
+}
+
+/*
+ * free_block - Coalesce the just-freed block at bp and give memory back to
+ * the OS where it is worth it. If the coalesced block is the last one in the
+ * heap and at least TRIM_THRESHOLD bytes, the heap is trimmed. Otherwise, if
+ * it is at least RELEASE_THRESHOLD bytes, the whole pages inside it are
+ * released with madvise and fault back in, zeroed, when reused.
+ *
+ * Every free block of RELEASE_THRESHOLD bytes or more has already had its
+ * pages released, so when bp merges with such a neighbour only the pages
+ * that were not part of that neighbour need releasing.
+ */
+static void free_block(void *bp)
+{
+    void *next = next_payload(bp);
+    char *lo = NULL, *hi = NULL;
+
+    if (!prev_allocated(bp) && header(prev_payload(bp))->size >= RELEASE_THRESHOLD) {
+        lo = (char *)header(bp);
+    }
+    if (!header(next)->allocated && header(next)->size >= RELEASE_THRESHOLD) {
+        hi = (char *)header(next);
+    }
+
+    bp = coalesce(bp);
+    size_t size = header(bp)->size;
+
+    if (size >= TRIM_THRESHOLD && header(next_payload(bp))->size == 0) {
+        trim_heap(TRIM_THRESHOLD);
+    } else if (size >= RELEASE_THRESHOLD) {
+        // Keep the header and footer resident
+        if (lo == NULL) {
+            lo = bp;
+        }
+        if (hi == NULL) {
+            hi = (char *)footer(bp);
+        }
+        mem_release(lo, hi - lo);
+    }
+}
+
+/*
+ * trim_heap - If the last block before the epilogue is free and at least
+ * `threshold` bytes, shrink the heap from the top, leaving CHUNKSIZE bytes
+ * (rounded up to a page) in that block. Returns the number of bytes removed.
+ */
+static size_t trim_heap(size_t threshold)
+{
+    void *epilogue = mem_sbrk(0);
+    size_t shrink, remaining;
+
+    if (prev_allocated(epilogue)) {
+        return 0;
+    }
+    void *last = prev_payload(epilogue);
+    size_t size = header(last)->size;
+
+    if (size < threshold || size <= CHUNKSIZE) {
+        return 0;
+    }
+    shrink = (size - CHUNKSIZE) & ~(size_t)(CHUNKSIZE - 1);
+    if (shrink == 0) {
+        return 0;
+    }
+
+    /* New epilogue header */
+    header(last)->size = size - shrink;
+    set_epilogue(next_payload(last), 0);
+    set_free(last, size - shrink);
+
+    // mem_sbrk takes an int, so give back huge tops in pieces
+    for (remaining = shrink; remaining > 0; ) {
+        int step = (remaining > (1 << 30)) ? (1 << 30) : (int)remaining;
+        mem_sbrk(-step);
+        remaining -= step;
+    }
+    return shrink;
+}
+
+/*
+ * mm_trim - Shrink the heap as far as possible, leaving at most CHUNKSIZE
+ * bytes free at the top. Returns the number of bytes removed from the heap.
+ */
+size_t mm_trim(void)
+{
+    if (heap_listp == 0)
+        return 0;
+    return trim_heap(0);
+}
+
+/*
+ * mm_bytes_returned - Resident bytes given back to the OS so far, by trimming
+ * the heap or by releasing the pages of large free blocks.
+ */
+size_t mm_bytes_returned(void)
+{
+    return mem_bytes_released();
+}
+
+/*
+ * fix_rover - bp has just grown over the blocks after it. If the next-fit
+ * rover pointed at one of them, move it back to the start of bp.
+ */
+static inline void fix_rover(void *bp)
+{
+    if (rover > (char *)bp && rover < (char *)next_payload(bp)) {
+        rover = bp;
+    }
 }
 
 /*
@@ -238,54 +491,51 @@ void mm_free(void *bp)
  */
 static void *coalesce(void *bp)
 {
-    size_t prev_alloc = footer(prev_payload(bp))->allocated;
+    size_t prev_alloc = prev_allocated(bp);
     size_t next_alloc = header(next_payload(bp))->allocated;
     size_t block_size = header(bp)->size;
     
     if (prev_alloc == 1 && next_alloc == 1) {            /* Case 1, no coalescing needed, blocks are not free */
+        STAT_INC(coalesce[0]);
         return bp;
     }
     else if (prev_alloc == 1 && next_alloc == 0) {      /* Case 2, coalesce, prev is not free but the next is free */
+        STAT_INC(coalesce[1]);
         block_size += header(next_payload(bp))->size;
-        header(bp)->size = block_size;
-        header(bp)->allocated = 0;
-
-        footer(bp)->size = block_size;
-        footer(bp)->allocated = 0;
-       
     }
     else if (prev_alloc == 0 && next_alloc == 1) {      /* Case 3 , coalesce, prev is free but next is allocated*/
+        STAT_INC(coalesce[2]);
         block_size +=  header(prev_payload(bp))->size;
-        footer(bp)->size = block_size;
-        footer(bp)->allocated = 0;
-
-        header(prev_payload(bp))->size = block_size; 
-        header(prev_payload(bp))->allocated = 0;  
         bp = prev_payload(bp);
-
     }
     else {                                     /* Case 4 */
+        STAT_INC(coalesce[3]);
         block_size += header(prev_payload(bp))->size + 
-        footer(next_payload(bp))->size;
-        header(prev_payload(bp))->size = block_size;
-        header(prev_payload(bp))->allocated = 0; 
-
-        footer(next_payload(bp))->size = block_size;
-        footer(next_payload(bp))->allocated = 0;
+        header(next_payload(bp))->size;
         bp = prev_payload(bp);
     }
 
+    set_free(bp, block_size);
+    fix_rover(bp);
     return bp;
 }
 
 /*
- * mm_realloc - Naive implementation of realloc
+ * mm_realloc - Resize the block at ptr, in place whenever possible.
+ *
+ * A block that shrinks is split and its tail freed. A block that grows first
+ * absorbs its successor if that is free and large enough, and if it is the
+ * last block in the heap (possibly after a free successor), the heap is
+ * extended under it. Only when neither works is the data copied into a new
+ * block.
  */
 void *mm_realloc(void *ptr, size_t size)
 {
     size_t oldsize;
     void *newptr;
 
+    STAT_INC(realloc_calls);
+
     /* If size == 0 then this is just free, and we return NULL. */
     if(size == 0) {
         mm_free(ptr);
@@ -297,6 +547,10 @@ void *mm_realloc(void *ptr, size_t size)
         return mm_malloc(size);
     }
 
+    if ((newptr = realloc_in_place(ptr, adjust_size(size))) != NULL) {
+        return newptr;
+    }
+
     newptr = mm_malloc(size);
 
     /* If realloc() fails the original block is left untouched  */
@@ -304,8 +558,8 @@ void *mm_realloc(void *ptr, size_t size)
         return 0;
     }
 
-    /* Copy the old data. */
-    oldsize = header(ptr)->size;
+    /* Copy the old data, the payload excludes the header and footer. */
+    oldsize = header(ptr)->size - ALLOC_OVERHEAD;
     if(size < oldsize) oldsize = size;
     memcpy(newptr, ptr, oldsize);
 
@@ -315,6 +569,73 @@ void *mm_realloc(void *ptr, size_t size)
     return newptr;
 }
 
+/*
+ * realloc_in_place - Try to resize the allocated block at bp to asize bytes
+ * without moving it. Returns bp on success and NULL if the block has to move.
+ */
+static void *realloc_in_place(void *bp, size_t asize)
+{
+    size_t oldsize = header(bp)->size;
+    size_t size = oldsize;
+    void *next = next_payload(bp);
+
+    if (asize <= size) {
+        split_allocated(bp, asize);
+        return bp;
+    }
+
+    // Absorb a free successor
+    if (!header(next)->allocated) {
+        size_t next_size = header(next)->size;
+
+        if (size + next_size < asize && header(next_payload(next))->size != 0) {
+            return NULL;
+        }
+        size += next_size;
+        set_allocated(bp, size);
+        fix_rover(bp);
+        next = next_payload(bp);
+    }
+
+    // The block now ends at the epilogue, so grow the heap under it
+    if (size < asize) {
+        size_t extendsize = ((asize - size + CHUNKSIZE - 1) / CHUNKSIZE) * CHUNKSIZE;
+
+        if (header(next)->size != 0 || extendsize > INT_MAX ||
+            mem_sbrk(extendsize) == (void *)-1) {
+            // Hand back a successor absorbed above
+            split_allocated(bp, oldsize);
+            return NULL;
+        }
+        size += extendsize;
+        header(bp)->size = size;
+
+        /* New epilogue header */
+        set_epilogue(next_payload(bp), 1);
+        set_allocated(bp, size);
+    }
+
+    split_allocated(bp, asize);
+    return bp;
+}
+
+/*
+ * split_allocated - Shrink the allocated block at bp to asize bytes, freeing
+ * the tail as a new block if it is at least the minimum block size.
+ */
+static void split_allocated(void *bp, size_t asize)
+{
+    size_t size = header(bp)->size;
+
+    if (size - asize < MIN_BLOCK_SIZE) {
+        return;
+    }
+    STAT_INC(splits);
+    set_allocated(bp, asize);
+    set_free(next_payload(bp), size - asize);
+    free_block(next_payload(bp));
+}
+
 /*
  * mm_checkheap - Check the heap for correctness
  */
@@ -339,16 +660,14 @@ static void *extend_heap(size_t words)
     size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
     if ((bp = mem_sbrk(size)) == (void *)-1) 
         return NULL;
+    STAT_INC(heap_extends);
+    STAT_ADD(heap_extend_bytes, size);
 
-    /* Initialize free block header/footer and the epilogue header */
+    /* Initialize free block header/footer and the epilogue header. The old 
+     * epilogue header becomes the new block's header and keeps its prev_alloc. */
     header(bp)->size = size;
-    header(bp)->allocated = 0;         /* Free block header */
-    footer(bp)->size = size;
-    footer(bp)->allocated = 0;
-       /* Free block footer */
-    header(next_payload(bp))->size = 0;
-    header(next_payload(bp))->allocated = 1; 
-    /* New epilogue header */
+    set_epilogue(next_payload(bp), 0);
+    set_free(bp, size);
 
     /* Coalesce if the previous block was free */
     return coalesce(bp);
@@ -362,49 +681,190 @@ static void place(void *bp, size_t asize)
 {
     size_t csize = header(bp)->size;
 
-    if ((csize - asize) >= (2*DWORD_SIZE)) {
-        header(bp)->size = asize;
-        header(bp)->allocated = 1; 
-        footer(bp)->size = asize;
-        footer(bp)->allocated = 1; 
-       
-        bp = next_payload(bp);
-        header(bp)->size = csize - asize;
-        header(bp)->allocated = 0;  
-
-        footer(bp)->size = csize - asize;
-        footer(bp)->allocated = 0;  
+    if ((csize - asize) >= MIN_BLOCK_SIZE) {
+        STAT_INC(splits);
+        set_allocated(bp, asize);
+        set_free(next_payload(bp), csize - asize);
     }
     else {
-        header(bp)->size = csize;
-        header(bp)->allocated = 1; 
-
-        footer(bp)->size = csize;
-        footer(bp)->allocated = 1;  
+        set_allocated(bp, csize);
     }
 }
 
 /*
- * find_fit - Find a fit for a block with asize bytes
+ * find_fit - Find a fit for a block with asize bytes, using the placement
+ * policy chosen at init
  */
 static void *find_fit(size_t asize)
 {
-    /* First-fit search */
-    void *bp;
+    void *bp, *best = NULL;
+    int candidates = 0;
+
+    fit_searches++;
+
+    if (fit_policy == MM_NEXT_FIT) {
+        /* Next-fit search, from the rover to the end and then from the start */
+        for (bp = rover; header(bp)->size > 0; bp = next_payload(bp)) {
+            fit_blocks_scanned++;
+            if (header(bp)->allocated == 0 && asize <= header(bp)->size) {
+                rover = bp;
+                return bp;
+            }
+        }
+        for (bp = heap_listp; bp != rover; bp = next_payload(bp)) {
+            fit_blocks_scanned++;
+            if (header(bp)->allocated == 0 && asize <= header(bp)->size) {
+                rover = bp;
+                return bp;
+            }
+        }
+        return NULL; /* No fit */
+    }
 
+    /* First-fit search, or best fit among the first fitting candidates */
     for (bp = heap_listp; header(bp)->size > 0; bp = next_payload(bp)) {
+        fit_blocks_scanned++;
         if (header(bp)->allocated == 0 && asize <= header(bp)->size) {
-            return bp;
+            if (fit_policy == MM_FIRST_FIT || header(bp)->size == asize) {
+                return bp;
+            }
+            if (best == NULL || header(bp)->size < header(best)->size) {
+                best = bp;
+            }
+            if (++candidates == best_fit_candidates) {
+                break;
+            }
         }
     }
-    return NULL; /* No fit */
+    return best;
+}
+
+/*
+ * mm_get_fit_stats - Report find_fit search lengths since init, and the
+ * free blocks in the heap right now
+ */
+void mm_get_fit_stats(struct mm_fit_stats *stats)
+{
+    void *bp;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->searches = fit_searches;
+    stats->blocks_scanned = fit_blocks_scanned;
+    stats->misses = fit_misses;
+    if (heap_listp == 0)
+        return;
+
+    for (bp = heap_listp; header(bp)->size > 0; bp = next_payload(bp)) {
+        if (header(bp)->allocated == 0) {
+            stats->free_blocks++;
+            stats->free_bytes += header(bp)->size;
+            if (header(bp)->size > stats->largest_free)
+                stats->largest_free = header(bp)->size;
+        }
+    }
+}
+
+/*
+ * stats_tick - Count a call to mm_malloc, and print the counters every
+ * stats_interval calls. Does nothing in builds without MM_STATS.
+ */
+static inline void stats_tick(void)
+{
+#ifdef MM_STATS
+    STAT_INC(malloc_calls);
+    if (stats_interval && counters.malloc_calls % stats_interval == 0)
+        stats_print_counters(stderr, &counters);
+#endif
+}
+
+/*
+ * stats_bucket - Histogram bucket of a block of `size` bytes
+ */
+static inline int stats_bucket(size_t size)
+{
+    int bucket = 64 - __builtin_clzl(size) - 1 - STATS_BUCKET_LOG2;
+
+    if (bucket < 0)
+        return 0;
+    return (bucket < MM_STATS_BUCKETS) ? bucket : MM_STATS_BUCKETS - 1;
+}
+
+/*
+ * stats_print_counters - Print the event counters of `stats` on one line
+ */
+static void stats_print_counters(FILE *fp, struct mm_stats *stats)
+{
+    fprintf(fp, "mm_stats: malloc %zu free %zu realloc %zu | fit %zu scanned %zu | "
+            "coalesce %zu/%zu/%zu/%zu split %zu | extend %zu (%zu bytes)\n",
+            stats->malloc_calls, stats->free_calls, stats->realloc_calls,
+            stats->fit_searches, stats->fit_blocks_scanned,
+            stats->coalesce[0], stats->coalesce[1], stats->coalesce[2], stats->coalesce[3],
+            stats->splits, stats->heap_extends, stats->heap_extend_bytes);
+}
+
+/*
+ * mm_stats - Copy the counters into `stats` and fill in the histogram of
+ * live and free blocks. Returns 0, or -1 with `stats` zeroed in builds
+ * without MM_STATS.
+ */
+int mm_stats(struct mm_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+#ifdef MM_STATS
+    *stats = counters;
+    stats->fit_searches = fit_searches;
+    stats->fit_blocks_scanned = fit_blocks_scanned;
+    if (heap_listp == 0)
+        return 0;
+
+    // Skip the prologue, it is not a block anyone asked for
+    for (char *bp = next_payload(heap_listp); header(bp)->size > 0; bp = next_payload(bp)) {
+        if (header(bp)->allocated)
+            stats->live_blocks[stats_bucket(header(bp)->size)]++;
+        else
+            stats->free_blocks[stats_bucket(header(bp)->size)]++;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/*
+ * mm_stats_dump - Print the counters and the block size histogram to `fp`.
+ * Prints nothing in builds without MM_STATS.
+ */
+void mm_stats_dump(FILE *fp)
+{
+    struct mm_stats stats;
+
+    if (mm_stats(&stats) < 0)
+        return;
+    stats_print_counters(fp, &stats);
+    fprintf(fp, "mm_stats: %12s %10s %10s\n", "block bytes", "live", "free");
+    for (int i = 0; i < MM_STATS_BUCKETS; i++) {
+        if (stats.live_blocks[i] || stats.free_blocks[i])
+            fprintf(fp, "mm_stats: %11lu%s %10zu %10zu\n", 1UL << (i + STATS_BUCKET_LOG2),
+                    i == MM_STATS_BUCKETS - 1 ? "+" : " ",
+                    stats.live_blocks[i], stats.free_blocks[i]);
+    }
+}
+
+/*
+ * mm_stats_interval - Print the counters to stderr every `calls` calls to
+ * mm_malloc, or never if `calls` is 0. Only MM_STATS builds print.
+ */
+void mm_stats_interval(size_t calls)
+{
+#ifdef MM_STATS
+    stats_interval = calls;
+#endif
 }
 
 static void printblock(void *bp)
 {
     size_t hsize, halloc, fsize, falloc;
 
-    checkheap(0);
     hsize = header(bp)->size;
     halloc = header(bp)->allocated;
     fsize = footer(bp)->size;
@@ -415,6 +875,13 @@ static void printblock(void *bp)
         return;
     }
 
+#ifdef FOOTER_ELISION
+    if (halloc && bp != heap_listp) {
+        printf("%p: header: [%ld:%c] footer: -\n", bp,
+               hsize, (halloc ? 'a' : 'f'));
+        return;
+    }
+#endif
     printf("%p: header: [%ld:%c] footer: [%ld:%c]\n", bp,
            hsize, (halloc ? 'a' : 'f'),
            fsize, (falloc ? 'a' : 'f'));
@@ -425,6 +892,12 @@ static void checkblock(void *bp)
     if ((uintptr_t)bp % DWORD_SIZE)
         printf("Error: %p is not doubleword aligned\n", bp);
 
+#ifdef FOOTER_ELISION
+    // Allocated blocks other than the prologue have no footer
+    if (header(bp)->allocated == 1 && bp != heap_listp)
+        return;
+#endif
+
     if (header(bp)->size != footer(bp)->size)
         printf("Error: header does not match footer\n");
 
@@ -458,6 +931,10 @@ void checkheap(int verbose)
         if (verbose)
             printblock(bp);
         checkblock(bp);
+#ifdef FOOTER_ELISION
+        if (header(next_payload(bp))->prev_alloc != header(bp)->allocated)
+            printf("Error: prev_alloc bit after %p does not match\n", bp);
+#endif
     }
 
     if (verbose)
@@ -1,11 +1,59 @@
 #ifndef __MM_H__
 #define __MM_H__
 #include <stddef.h>
+#include <stdio.h>
+
+/* Placement policies for mm_init_policy */
+enum mm_fit_policy {
+    MM_FIRST_FIT,   /* first block that fits, from the start of the heap */
+    MM_NEXT_FIT,    /* first block that fits, from where the last search stopped */
+    MM_BEST_FIT,    /* smallest of the first N blocks that fit */
+};
+
+/* find_fit search lengths, and free space in the heap, see mm_get_fit_stats */
+struct mm_fit_stats {
+    size_t searches;        /* calls to find_fit */
+    size_t blocks_scanned;  /* blocks looked at by those calls */
+    size_t misses;          /* searches that found nothing and grew the heap */
+    size_t free_blocks;     /* free blocks in the heap now */
+    size_t free_bytes;      /* bytes in those free blocks */
+    size_t largest_free;    /* size of the largest of them */
+};
+
+/*
+ * Buckets of the mm_stats block histogram: bucket i counts blocks of 2^(i+5)
+ * up to 2^(i+6) - 1 bytes. The first bucket also takes smaller blocks and
+ * the last one everything larger.
+ */
+#define MM_STATS_BUCKETS 20
+
+/* Allocator counters, kept only in MM_STATS builds, see mm_stats */
+struct mm_stats {
+    size_t malloc_calls;
+    size_t free_calls;
+    size_t realloc_calls;
+    size_t fit_searches;        /* calls to find_fit */
+    size_t fit_blocks_scanned;  /* blocks looked at by those calls */
+    size_t coalesce[4];         /* coalesce cases: no free neighbour, next, prev, both */
+    size_t splits;              /* blocks split by place or a shrinking realloc */
+    size_t heap_extends;        /* calls to extend_heap */
+    size_t heap_extend_bytes;   /* bytes they added to the heap */
+    size_t live_blocks[MM_STATS_BUCKETS];  /* allocated blocks by size, now */
+    size_t free_blocks[MM_STATS_BUCKETS];  /* free blocks by size, now */
+};
 
 void mm_init(void);
+void mm_init_policy(enum mm_fit_policy policy, int candidates);
 void mm_deinit(void);
 void *mm_malloc(size_t size);
 void mm_free(void *ptr);
+void *mm_realloc(void *ptr, size_t size);
 void mm_checkheap(int verbose);
+size_t mm_trim(void);
+size_t mm_bytes_returned(void);
+void mm_get_fit_stats(struct mm_fit_stats *stats);
+int mm_stats(struct mm_stats *stats);
+void mm_stats_dump(FILE *fp);
+void mm_stats_interval(size_t calls);
 
 #endif
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "mm.h"
 
@@ -22,10 +23,38 @@ int main(int argc, char **argv)
     mm_free(q);
  
     mm_deinit();
+    mm_deinit();    // must be harmless with no default region
 
-}
+    // A region grows past its first chunk and resets back to the start
+    struct region *region = region_create();
+    if (!region) {
+        perror("region_create");
+        exit(1);
+    }
 
- 
+    char *first = region_alloc(region, 100);
+    struct region_mark mark = region_mark(region);
+    char *after_mark = region_alloc(region, 200);
+    for (int i = 0; i < 1000; i++) {
+        char *s = region_alloc(region, 1000);
+        if (!s) {
+            perror("region_alloc");
+            exit(1);
+        }
+        memset(s, 'B', 1000);
+    }
 
-   
+    region_reset_to_mark(region, mark);
+    if (region_alloc(region, 200) != after_mark) {
+        fprintf(stderr, "reset to mark did not rewind the region\n");
+        exit(1);
+    }
 
+    region_reset(region);
+    if (region_used(region) != 0 || region_alloc(region, 100) != first) {
+        fprintf(stderr, "reset did not rewind the region\n");
+        exit(1);
+    }
+
+    region_destroy(region);
+}
@@ -1,3 +1,20 @@
+/*
+ * mm.c - A bump (region) allocator.
+ *
+ * A region is a run of memory handed out by bumping a pointer. Objects are
+ * never freed one at a time; instead the whole region, or everything
+ * allocated after a saved mark, is released at once by moving the pointer
+ * back. That suits work with a clear lifetime, like everything a worker
+ * allocates while processing one file: allocate freely, then reset the
+ * region when the file is done.
+ *
+ * Each region owns a libmem arena, so regions are independent and each one
+ * grows in place. A reset keeps the arena's pages committed and the next
+ * allocations reuse them without any system call.
+ *
+ * mm_malloc/mm_free work on a default region. mm_free is a no-op.
+ * A region is not synchronized; threads sharing one must lock around it.
+ */
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -8,88 +25,151 @@
 #include "mem.h"
 
 #define DWORD_SIZE   16    // Defines the alignment boundary for memory allocation (16-byte alignment).
-#define PAGE_SIZE  4096    // Defines the size of a page (4096 bytes), used to grow the heap.
+#define REGION_GROW  (64 * 1024)     // Grow a region's arena by at least this much at a time.
+#define REGION_RESERVE (16ULL << 30) // Address space reserved for each region.
 
-static void *heap_ptr = NULL;        // Pointer to the start of the heap.
-static size_t remaining_heap = 0;    // Tracks the amount of remaining space in the heap.
+struct region {
+    struct mem_arena *arena;
+    char *base;     /* First byte handed out */
+    char *top;      /* Next free byte */
+    char *end;      /* End of the arena's current break */
+};
 
-void mm_init(void)
+static struct region *default_region = NULL;
+
+static inline size_t align_up(size_t n, size_t align)
+{
+    return (n + align - 1) & ~(align - 1);
+}
+
+/*
+ * region_create - Make an empty region. Returns NULL with errno set if its
+ * address space cannot be reserved.
+ */
+struct region *region_create(void)
 {
-    mem_init();  // Initializes the memory system.
+    struct mem_arena *arena;
+    struct region *region;
 
-    // Grow the heap by one page (PAGE_SIZE) during initialization.
-    if ((heap_ptr = mem_sbrk(PAGE_SIZE)) == (void *) -1) {
-        perror("mem_sbrk");  // Handle the failure of mem_sbrk.
-        exit(1);
+    if ((arena = mem_arena_create(REGION_RESERVE)) == NULL) {
+        return NULL;
+    }
+    // The region bookkeeping sits at the start of its own arena
+    if ((region = mem_arena_sbrk(arena, align_up(sizeof(struct region), DWORD_SIZE))) == (void *) -1) {
+        mem_arena_destroy(arena);
+        return NULL;
     }
-    
+
     // Ensure the heap is properly aligned to a 16-byte boundary.
-    assert(((uint64_t) heap_ptr) % DWORD_SIZE == 0);
-    remaining_heap = 4096;  // Initialize the remaining heap size to the size of a single page (4096 bytes).
+    assert(((uintptr_t) region) % DWORD_SIZE == 0);
+    region->arena = arena;
+    region->base = (char *)(region + 1);
+    region->base = (char *)align_up((uintptr_t)region->base, DWORD_SIZE);
+    region->top = region->base;
+    region->end = region->base;
+    return region;
 }
 
-void *mm_malloc(size_t size)
+/*
+ * region_alloc - Allocate size bytes, 16-byte aligned, from region.
+ * Returns NULL if size is 0 or the region's reservation is exhausted.
+ */
+void *region_alloc(struct region *region, size_t size)
 {
-    assert(((uint64_t) heap_ptr) % DWORD_SIZE == 0);  // Ensure heap pointer is 16-byte aligned.
+    size_t asize;      /* Adjusted block size, a multiple of the alignment. */
 
-    size_t asize;      /* Adjusted block size, taking overhead and alignment into account. */
-    size_t extendsize; /* Amount to extend the heap if there's not enough memory left. */
-
-    // Initialize the heap if it hasn't been initialized yet.
-    if (heap_ptr == NULL) {
-        mm_init();
-    }
-
-    // Return NULL if a zero-size request is made (not valid in this implementation).
-    if (size == 0) {
+    if (size == 0 || size > REGION_RESERVE) {
         return NULL;
     }
+    asize = align_up(size, DWORD_SIZE);
 
-    // Brute force approach to memory allocation: adjust the requested size to ensure alignment.
-    /* Adjust block size to include overhead (header/footer) and alignment requirements. */
-    if (size <= DWORD_SIZE)
-        asize = 2 * DWORD_SIZE;  // Ensure at least a block of 16 bytes.
-    else
-        asize = DWORD_SIZE * ((size + (DWORD_SIZE) + (DWORD_SIZE - 1)) / DWORD_SIZE); // Round up to next multiple of DWORD_SIZE.
+    // Not enough room left: grow the arena. Its break only moves up, so
+    // the new bytes follow on from end.
+    if (asize > (size_t)(region->end - region->top)) {
+        size_t extendsize = align_up(asize - (region->end - region->top), REGION_GROW);
 
-    // If the requested block size exceeds the remaining heap size, we need to extend the heap.
-    if (asize > remaining_heap) {
-        size_t shortfall = asize - remaining_heap;  // Calculate how much more memory we need.
+        if (mem_arena_sbrk(region->arena, extendsize) == (void *) -1) {
+            return NULL;
+        }
+        region->end += extendsize;
+    }
 
-        // If the shortfall is greater than the available page size, we extend by double the page size.
-        extendsize = (shortfall <= PAGE_SIZE) ? PAGE_SIZE : 2 * PAGE_SIZE;
+    void *allocated_block = region->top;
+    region->top += asize;
+    return allocated_block;
+}
 
-        // Request additional memory from the operating system to satisfy the shortfall.
-        if ((heap_ptr = mem_sbrk(extendsize)) == (void *) -1) {
-            perror("mem_sbrk");  // Handle failure of mem_sbrk.
-            exit(1);
-        }
+/*
+ * region_mark - Save the current allocation point of region.
+ */
+struct region_mark region_mark(struct region *region)
+{
+    struct region_mark mark = { region->top };
+    return mark;
+}
 
-        // Update the remaining heap size after extending the heap.
-        remaining_heap += extendsize;
-    }
+/*
+ * region_reset_to_mark - Release everything allocated from region since
+ * `mark` was taken. Marks taken after `mark` become invalid.
+ */
+void region_reset_to_mark(struct region *region, struct region_mark mark)
+{
+    assert(mark.top >= region->base && mark.top <= region->top);
+    region->top = mark.top;
+}
 
-    // Allocate the block from the current heap position.
-    void *allocated_block = heap_ptr;
-    heap_ptr += asize;  // Move the heap pointer forward by the size of the allocated block.
-    remaining_heap -= asize;  // Update the remaining heap size.
+/*
+ * region_reset - Release everything allocated from region in O(1). The
+ * pages stay committed and are reused by the next allocations.
+ */
+void region_reset(struct region *region)
+{
+    region->top = region->base;
+}
 
-    /* Ensure alignment of the returned address (debug check). */
-    assert(((uintptr_t)allocated_block) % DWORD_SIZE == 0);  // Verify that the allocated block is 16-byte aligned.
+/*
+ * region_used - Bytes currently allocated from region, padding included.
+ */
+size_t region_used(struct region *region)
+{
+    return region->top - region->base;
+}
 
-    // For debugging purposes, print the allocation details.
-    printf("Allocated block at: %p, size: %zu bytes, remaining_heap: %zu bytes\n", allocated_block, asize, remaining_heap);
+/*
+ * region_destroy - Release region and all of its memory.
+ */
+void region_destroy(struct region *region)
+{
+    mem_arena_destroy(region->arena);
+}
 
-    return allocated_block;  // Return the pointer to the allocated block.
+void mm_init(void)
+{
+    if ((default_region = region_create()) == NULL) {
+        perror("region_create");
+        exit(1);
+    }
+}
+
+void *mm_malloc(size_t size)
+{
+    // Initialize the heap if it hasn't been initialized yet.
+    if (default_region == NULL) {
+        mm_init();
+    }
+    return region_alloc(default_region, size);
 }
 
 void mm_free(void *p)
 {
-    // No-op: This function does not do anything in this simple implementation.
-    // Memory freeing would require a more complex implementation such as a free list or coalescing blocks.
+    // No-op: memory goes back when the region is reset or destroyed.
 }
 
 void mm_deinit(void)
 {
-    mem_deinit();  // De-initialize the memory system when done.
+    // The default region may never have been made, or already be gone
+    if (default_region) {
+        region_destroy(default_region);
+        default_region = NULL;
+    }
 }
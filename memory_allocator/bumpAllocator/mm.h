@@ -7,4 +7,19 @@ void *mm_malloc(size_t size);
 void mm_free(void *p);
 void mm_deinit(void);
 
+struct region;
+
+/* A saved allocation point, see region_mark */
+struct region_mark {
+    char *top;
+};
+
+struct region *region_create(void);
+void *region_alloc(struct region *region, size_t size);
+struct region_mark region_mark(struct region *region);
+void region_reset_to_mark(struct region *region, struct region_mark mark);
+void region_reset(struct region *region);
+size_t region_used(struct region *region);
+void region_destroy(struct region *region);
+
 #endif
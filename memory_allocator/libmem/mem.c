@@ -1,8 +1,37 @@
 /*
  * memlib.c - a module that simulates the memory system. Adapted from CSAPP3e.
+ *
+ * Each arena reserves a large range of virtual addresses up front with
+ * PROT_NONE, which costs no memory. Pages are committed (made readable and
+ * writable) only as the break grows past them, so a heap can grow to
+ * gigabytes in place, without ever moving or being copied.
+ *
+ * The break can also move back down. Whole pages above the new break, and
+ * any page-aligned range an allocator hands to mem_release, are given back
+ * to the OS with madvise(MADV_DONTNEED). They stay mapped and read/write,
+ * so they read back as zeros and regrowing needs no system call.
+ *
+ * mem_init/mem_sbrk/mem_deinit work on a default arena. Independent heaps,
+ * for example one per thread or per subsystem, can be made with
+ * mem_arena_create and grown with mem_arena_sbrk. An arena is not
+ * synchronized; callers sharing one across threads must lock around it.
+ *
+ * Allocators can also take memory outside any heap, one mapping per block,
+ * with mem_map, mem_remap and mem_unmap. These are thread-safe.
+ *
+ * After mem_set_huge_pages(1), mem_init backs the default arena with 2 MB
+ * transparent huge pages, with madvise(MADV_HUGEPAGE), so walking a large
+ * heap takes far fewer TLB misses. If THP is not available it quietly falls
+ * back to normal pages. MAP_HUGETLB is not used: a hugetlbfs mapping takes
+ * its pages from the pool up front, for the whole reservation rather than
+ * the part the heap commits, and can't grow in place. Huge page arenas
+ * commit and release memory in whole 2 MB pages, and mem_huge_page_size
+ * tells allocators to grow the heap in 2 MB steps too.
  */
+#define _GNU_SOURCE     // for mremap
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <assert.h>
 #include <unistd.h>
 #include <sys/mman.h>
@@ -12,50 +41,391 @@
 #include "mem.h"
 
 #ifndef MAX_HEAP
-#define MAX_HEAP (4 * (1 << 20))  // 4 MB
+#define MAX_HEAP (16ULL << 30)  // 16 GB of address space for the default arena
 #endif
 
-static char *mem_heap;     /* Points to first byte of heap */
-static char *mem_brk;      /* Points to last byte of heap plus 1 */
-static char *mem_max_addr; /* Max legal heap addr plus 1*/
+#ifndef MEM_COMMIT_SIZE
+#define MEM_COMMIT_SIZE (64 << 10)  // commit pages 64 KB at a time
+#endif
+
+#define HUGE_PAGE_SIZE (2UL << 20)
+
+struct mem_arena {
+    char *mem_heap;      /* Points to first byte of heap */
+    char *mem_brk;       /* Points to last byte of heap plus 1 */
+    char *mem_committed; /* Points to last read/write byte plus 1 */
+    char *mem_max_addr;  /* Max legal heap addr plus 1 */
+    size_t reserved;     /* Size of the whole mapping, arena header included */
+    size_t page;         /* Commit and release granularity */
+};
+
+static struct mem_arena default_arena;
+
+/* Whether mem_init should try huge pages */
+static int use_huge_pages;
+
+/* Resident bytes given back to the OS, across all arenas */
+static size_t released_bytes;
+
+/* Bytes below the break in all arenas plus bytes in direct mappings, and
+ * the most there have been */
+static size_t heap_bytes;
+static size_t heap_peak;
+
+static size_t page_size(void)
+{
+    static size_t pagesize;
+
+    if (pagesize == 0) {
+        pagesize = sysconf(_SC_PAGESIZE);
+    }
+    return pagesize;
+}
+
+static inline size_t round_up(size_t n, size_t align)
+{
+    return (n + align - 1) & ~(align - 1);
+}
+
+static void heap_bytes_add(size_t incr)
+{
+    size_t now = __atomic_add_fetch(&heap_bytes, incr, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&heap_peak, __ATOMIC_RELAXED);
+
+    while (now > peak && !__atomic_compare_exchange_n(&heap_peak, &peak, now, 1,
+                                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void heap_bytes_sub(size_t decr)
+{
+    __atomic_fetch_sub(&heap_bytes, decr, __ATOMIC_RELAXED);
+}
+
+/*
+ * release_pages - madvise away the whole `granule`-sized pages in
+ * [start, end) and count how many bytes of them were resident. Pages that
+ * were never touched, or were already released, are not counted again.
+ */
+static void release_pages(char *start, char *end, size_t granule)
+{
+    size_t pagesize = page_size();
+    unsigned char vec[1024];
+    size_t resident = 0;
+
+    start = (char *)round_up((uintptr_t)start, granule);
+    end = (char *)((uintptr_t)end & ~(granule - 1));
+    if (start >= end) {
+        return;
+    }
+
+    for (char *p = start; p < end; p += sizeof(vec) * pagesize) {
+        size_t len = end - p;
+        if (len > sizeof(vec) * pagesize) {
+            len = sizeof(vec) * pagesize;
+        }
+        if (mincore(p, len, vec) == 0) {
+            for (size_t i = 0; i < len / pagesize; i++) {
+                resident += vec[i] & 1;
+            }
+        }
+    }
+
+    if (madvise(start, end - start, MADV_DONTNEED) == 0) {
+        __atomic_fetch_add(&released_bytes, resident * pagesize, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * arena_map - reserve `reserve` bytes of address space for `arena`, with
+ * `offset` bytes in front of the heap that are committed right away.
+ * Returns the start of the mapping, or NULL if mmap fails.
+ */
+static char *arena_map(struct mem_arena *arena, size_t offset, size_t reserve)
+{
+    char *base = mmap(NULL, offset + reserve, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    if (offset > 0 && mprotect(base, offset, PROT_READ | PROT_WRITE) < 0) {
+        munmap(base, offset + reserve);
+        return NULL;
+    }
+    arena->mem_heap = base + offset;
+    arena->mem_brk = arena->mem_heap;
+    arena->mem_committed = arena->mem_heap;
+    arena->mem_max_addr = arena->mem_heap + reserve;
+    arena->reserved = offset + reserve;
+    arena->page = page_size();
+    return base;
+}
+
+/*
+ * arena_map_huge - reserve `reserve` bytes of address space for `arena`
+ * backed by transparent huge pages. Returns the start of the mapping, or
+ * NULL if THP can't back it.
+ */
+static char *arena_map_huge(struct mem_arena *arena, size_t reserve)
+{
+#ifdef MADV_HUGEPAGE
+    char *base;
+
+    reserve = round_up(reserve, HUGE_PAGE_SIZE);
+
+    // Over-reserve so the heap can start on a huge page boundary, and
+    // give back the ends
+    char *map = mmap(NULL, reserve + HUGE_PAGE_SIZE, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    base = (char *)round_up((uintptr_t)map, HUGE_PAGE_SIZE);
+    if (base > map) {
+        munmap(map, base - map);
+    }
+    munmap(base + reserve, map + HUGE_PAGE_SIZE - base);
+    if (madvise(base, reserve, MADV_HUGEPAGE) < 0) {
+        munmap(base, reserve);
+        return NULL;
+    }
+    arena->mem_heap = arena->mem_brk = arena->mem_committed = base;
+    arena->mem_max_addr = base + reserve;
+    arena->reserved = reserve;
+    arena->page = HUGE_PAGE_SIZE;
+    return base;
+#else
+    return NULL;
+#endif
+}
 
 /*
  * mem_init - Initialize the memory system model.
- *            Allocate an arena of size MAX_HEAP.
+ *            Reserve MAX_HEAP bytes of address space for the default arena,
+ *            backed by huge pages if mem_set_huge_pages asked for them and
+ *            the system has them.
  */
 void mem_init(void)
 {
-    mem_heap = mmap(NULL, MAX_HEAP, PROT_READ | PROT_WRITE,
-                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (mem_heap == MAP_FAILED) {
+    if (use_huge_pages && arena_map_huge(&default_arena, MAX_HEAP) != NULL) {
+        return;
+    }
+    if (arena_map(&default_arena, 0, round_up(MAX_HEAP, page_size())) == NULL) {
         perror("mmap");
         exit(1);
     }
-    mem_brk = (char *) mem_heap;
-    mem_max_addr = (char *)(mem_heap + MAX_HEAP);
+}
+
+/*
+ * mem_set_huge_pages - Ask the next mem_init for a huge page backed heap
+ *            (enable != 0) or a normal one. Arenas from mem_arena_create
+ *            always use normal pages.
+ */
+void mem_set_huge_pages(int enable)
+{
+    use_huge_pages = enable;
+}
+
+/*
+ * mem_huge_page_size - the huge page size backing the default arena, or 0
+ *            if it uses normal pages. Allocators round heap growth up to
+ *            it so that no huge page is left half used at the break.
+ */
+size_t mem_huge_page_size(void)
+{
+    return default_arena.page > page_size() ? default_arena.page : 0;
 }
 
 /*
  * mem_sbrk - Simple model of the sbrk function. Extends the heap
  *            by incr bytes and returns the start address of the new area.
- *            In this model, the heap cannot be shrunk.
+ *            A negative incr shrinks the heap and returns the old break.
  */
 void *mem_sbrk(int incr)
 {
-    char *old_brk = mem_brk;
+    return mem_arena_sbrk(&default_arena, incr);
+}
 
-    if ((incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+/*
+ * mem_deinit - free the storage used by the memory system model
+ */
+void mem_deinit(void)
+{
+    heap_bytes_sub(default_arena.mem_brk - default_arena.mem_heap);
+    munmap(default_arena.mem_heap, default_arena.reserved);
+    memset(&default_arena, 0, sizeof(default_arena));
+}
+
+/*
+ * mem_arena_create - Reserve an independent heap of up to `reserve` bytes.
+ *            The arena bookkeeping lives in the first page of its own
+ *            mapping, and the heap starts on the page after it.
+ *            Returns NULL with errno set if the range cannot be reserved.
+ */
+struct mem_arena *mem_arena_create(size_t reserve)
+{
+    struct mem_arena arena;
+    size_t offset = round_up(sizeof(struct mem_arena), page_size());
+    char *base;
+
+    if ((base = arena_map(&arena, offset, round_up(reserve, page_size()))) == NULL) {
+        return NULL;
+    }
+    memcpy(base, &arena, sizeof(arena));
+    return (struct mem_arena *)base;
+}
+
+/*
+ * mem_arena_sbrk - Extend the heap of `arena` by incr bytes and return the
+ *            start address of the new area, committing pages as needed.
+ *            A negative incr moves the break down, releases the pages above
+ *            it and returns the old break.
+ *            Returns (void *) -1 with errno set to ENOMEM if the arena's
+ *            reservation is exhausted, or to EINVAL if the break would drop
+ *            below the start of the heap.
+ */
+void *mem_arena_sbrk(struct mem_arena *arena, intptr_t incr)
+{
+    char *old_brk = arena->mem_brk;
+
+    if (incr < 0) {
+        if (-incr > arena->mem_brk - arena->mem_heap) {
+            errno = EINVAL;
+            return (void *) -1;
+        }
+        arena->mem_brk += incr;
+        heap_bytes_sub(-incr);
+        release_pages(arena->mem_brk, (char *)round_up((uintptr_t)old_brk, arena->page),
+                      arena->page);
+        return (void *) old_brk;
+    }
+
+    if (incr > arena->mem_max_addr - arena->mem_brk) {
         errno = ENOMEM;
         return (void *) -1;
     }
-    mem_brk += incr;
+
+    if (arena->mem_brk + incr > arena->mem_committed) {
+        size_t grow = round_up(arena->mem_brk + incr - arena->mem_committed,
+                               arena->page > MEM_COMMIT_SIZE ? arena->page : MEM_COMMIT_SIZE);
+        if (grow > (size_t)(arena->mem_max_addr - arena->mem_committed)) {
+            grow = arena->mem_max_addr - arena->mem_committed;
+        }
+        if (mprotect(arena->mem_committed, grow, PROT_READ | PROT_WRITE) < 0) {
+            errno = ENOMEM;
+            return (void *) -1;
+        }
+        arena->mem_committed += grow;
+    }
+
+    arena->mem_brk += incr;
+    heap_bytes_add(incr);
     return (void *) old_brk;
 }
 
 /*
- * mem_deinit - free the storage used by the memory system model
+ * mem_release - give the whole pages inside [addr, addr + len) back to the
+ *            OS. The range stays valid and reads back as zeros. Allocators
+ *            use this on the interior of large free blocks.
  */
-void mem_deinit(void)
+void mem_release(void *addr, size_t len)
+{
+    size_t granule = page_size();
+
+    // Releasing part of a huge page would split it
+    if ((char *)addr >= default_arena.mem_heap && (char *)addr < default_arena.mem_max_addr) {
+        granule = default_arena.page;
+    }
+    release_pages(addr, (char *)addr + len, granule);
+}
+
+/*
+ * mem_bytes_released - total resident bytes given back to the OS so far,
+ *            by shrinking a break or by mem_release, across all arenas.
+ */
+size_t mem_bytes_released(void)
+{
+    return __atomic_load_n(&released_bytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * mem_map - map `len` bytes of zeroed memory outside any heap, for a single
+ *            large block. Returns NULL with errno set if mmap fails.
+ */
+void *mem_map(size_t len)
+{
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    heap_bytes_add(len);
+    return p;
+}
+
+/*
+ * mem_remap - resize a mapping from mem_map to `new_len` bytes. The kernel
+ *            moves the pages if it has to, without copying them. Returns
+ *            the new address, or NULL with errno set and the mapping
+ *            unchanged.
+ */
+void *mem_remap(void *addr, size_t old_len, size_t new_len)
+{
+    void *p = mremap(addr, old_len, new_len, MREMAP_MAYMOVE);
+
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    if (new_len > old_len) {
+        heap_bytes_add(new_len - old_len);
+    } else {
+        heap_bytes_sub(old_len - new_len);
+    }
+    return p;
+}
+
+/*
+ * mem_unmap - release a mapping from mem_map
+ */
+void mem_unmap(void *addr, size_t len)
+{
+    munmap(addr, len);
+    heap_bytes_sub(len);
+}
+
+/*
+ * mem_heapsize - bytes currently below the break, across all arenas, plus
+ *            bytes in mappings from mem_map.
+ */
+size_t mem_heapsize(void)
+{
+    return __atomic_load_n(&heap_bytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * mem_heap_peak - the largest mem_heapsize has been since the last
+ *            mem_heap_peak_reset. Benchmarks use it to measure utilization.
+ */
+size_t mem_heap_peak(void)
+{
+    return __atomic_load_n(&heap_peak, __ATOMIC_RELAXED);
+}
+
+/*
+ * mem_heap_peak_reset - start measuring the peak again from the current size
+ */
+void mem_heap_peak_reset(void)
+{
+    __atomic_store_n(&heap_peak, mem_heapsize(), __ATOMIC_RELAXED);
+}
+
+/*
+ * mem_arena_destroy - release an arena and everything allocated from it
+ */
+void mem_arena_destroy(struct mem_arena *arena)
 {
-    munmap(mem_heap, MAX_HEAP);
+    // The arena header lives in the mapping, so read its size first
+    size_t reserved = arena->reserved;
+    heap_bytes_sub(arena->mem_brk - arena->mem_heap);
+    munmap(arena, reserved);
 }
@@ -1,8 +1,27 @@
 #ifndef __MEM_H__
 #define __MEM_H__
 
+#include <stddef.h>
+#include <stdint.h>
+
+struct mem_arena;
+
 void mem_init(void);
+void mem_set_huge_pages(int enable);
+size_t mem_huge_page_size(void);
 void *mem_sbrk(int incr);
 void mem_deinit(void);
+void mem_release(void *addr, size_t len);
+size_t mem_bytes_released(void);
+void *mem_map(size_t len);
+void *mem_remap(void *addr, size_t old_len, size_t new_len);
+void mem_unmap(void *addr, size_t len);
+size_t mem_heapsize(void);
+size_t mem_heap_peak(void);
+void mem_heap_peak_reset(void);
+
+struct mem_arena *mem_arena_create(size_t reserve);
+void *mem_arena_sbrk(struct mem_arena *arena, intptr_t incr);
+void mem_arena_destroy(struct mem_arena *arena);
 
 #endif
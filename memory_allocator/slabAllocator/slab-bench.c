@@ -0,0 +1,93 @@
+/*
+ * slab-bench.c - slab_alloc/slab_free against mm_malloc/mm_free for small
+ * fixed-size objects.
+ *
+ * This follows the greptile print queue: a batch of objects is allocated,
+ * one per matching line, and then freed in the same order as the queue is
+ * printed. Each round repeats that with BATCH objects, for object sizes
+ * from 24 to 64 bytes. The mm_malloc numbers come from the explicit free
+ * list allocator.
+ *
+ *   make bench && ./slab-bench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mm.h"
+#include "slab.h"
+
+#define BATCH  10000
+#define ROUNDS 100
+
+static const size_t obj_sizes[] = {24, 32, 40, 48, 56, 64};
+
+static void *objs[BATCH];
+
+static double elapsed_ns(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+static double bench_slab(size_t size)
+{
+    struct timespec start, end;
+    struct slab *slab = slab_create(size);
+
+    if (!slab) {
+        perror("slab_create");
+        exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < BATCH; i++) {
+            if (!(objs[i] = slab_alloc(slab))) {
+                perror("slab_alloc");
+                exit(1);
+            }
+            *(char *)objs[i] = 'A';
+        }
+        for (int i = 0; i < BATCH; i++) {
+            slab_free(slab, objs[i]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    slab_destroy(slab);
+    return elapsed_ns(&start, &end) / ((double)ROUNDS * BATCH);
+}
+
+static double bench_mm(size_t size)
+{
+    struct timespec start, end;
+
+    mm_init();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < BATCH; i++) {
+            if (!(objs[i] = mm_malloc(size))) {
+                perror("mm_malloc");
+                exit(1);
+            }
+            *(char *)objs[i] = 'A';
+        }
+        for (int i = 0; i < BATCH; i++) {
+            mm_free(objs[i]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    mm_checkheap(0);
+    mm_deinit();
+    return elapsed_ns(&start, &end) / ((double)ROUNDS * BATCH);
+}
+
+int main(int argc, char **argv)
+{
+    printf("%8s %20s %20s\n", "bytes", "slab ns per pair", "mm ns per pair");
+
+    for (size_t i = 0; i < sizeof(obj_sizes) / sizeof(obj_sizes[0]); i++) {
+        size_t size = obj_sizes[i];
+
+        printf("%8zu %20.1f %20.1f\n", size, bench_slab(size), bench_mm(size));
+    }
+    return 0;
+}
@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "slab.h"
+
+#define NOBJS 10000
+
+int main(int argc, char **argv)
+{
+    struct slab *slab = slab_create(24);
+    char *objs[NOBJS];
+
+    if (!slab) {
+        perror("slab_create");
+        exit(1);
+    }
+
+    for (int i = 0; i < NOBJS; i++) {
+        if (!(objs[i] = slab_alloc(slab))) {
+            perror("slab_alloc");
+            exit(1);
+        }
+        memset(objs[i], i & 0xff, 24);
+    }
+    fprintf(stderr, "first=%p second=%p last=%p\n", objs[0], objs[1], objs[NOBJS - 1]);
+
+    for (int i = 0; i < NOBJS; i++) {
+        for (int j = 0; j < 24; j++) {
+            if (objs[i][j] != (char)(i & 0xff)) {
+                fprintf(stderr, "object %d was overwritten\n", i);
+                exit(1);
+            }
+        }
+    }
+
+    // A freed object is the next one handed out
+    slab_free(slab, objs[42]);
+    if (slab_alloc(slab) != objs[42]) {
+        fprintf(stderr, "freed object was not reused\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < NOBJS; i++) {
+        slab_free(slab, objs[i]);
+    }
+    slab_destroy(slab);
+}
@@ -0,0 +1,117 @@
+/*
+ * slab.c - An object pool for fixed-size objects, built on libmem.
+ *
+ * Every slab hands out objects of one size. It owns a libmem arena, grows it
+ * SLAB_GROW bytes at a time and carves the new pages into equal slots. A
+ * free slot holds the pointer to the next free slot in its first word, so
+ * the free list costs no memory and there are no headers, footers or size
+ * classes to search:
+ * - slab_alloc pops the free list, or bumps into the newest pages.
+ * - slab_free pushes the slot back on the free list.
+ * Both are a handful of instructions. Slots are never coalesced or given
+ * back to the OS until the slab is destroyed.
+ *
+ * The slab bookkeeping lives at the start of its own arena, so a slab needs
+ * no other allocator and can run next to mm_malloc on the default arena.
+ * A slab is not synchronized; threads sharing one must lock around it.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "mem.h"
+#include "slab.h"
+
+#define SLAB_ALIGN   8              /* Slot alignment, enough for pointers */
+#define SLAB_GROW    (64 * 1024)    /* Bytes added to the arena per refill */
+#define SLAB_RESERVE (1ULL << 30)   /* Address space reserved per slab */
+
+struct slab {
+    struct mem_arena *arena;
+    size_t obj_size;    /* Slot size, a multiple of SLAB_ALIGN */
+    void *free_list;    /* Freed slots, linked through their first word */
+    char *cur;          /* Next never-used slot */
+    char *end;          /* End of the arena's current break */
+};
+
+static inline size_t align_up(size_t n)
+{
+    return (n + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1);
+}
+
+/*
+ * slab_create - Make a pool of `obj_size`-byte objects. Returns NULL with
+ * errno set if obj_size is 0 or too large, or if no arena can be reserved.
+ */
+struct slab *slab_create(size_t obj_size)
+{
+    struct mem_arena *arena;
+    struct slab *slab;
+
+    if (obj_size == 0 || obj_size > SLAB_GROW) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if ((arena = mem_arena_create(SLAB_RESERVE)) == NULL) {
+        return NULL;
+    }
+    if ((slab = mem_arena_sbrk(arena, align_up(sizeof(struct slab)))) == (void *)-1) {
+        mem_arena_destroy(arena);
+        return NULL;
+    }
+
+    slab->arena = arena;
+    slab->obj_size = align_up(obj_size < sizeof(void *) ? sizeof(void *) : obj_size);
+    slab->free_list = NULL;
+    slab->cur = (char *)(slab + 1);
+    slab->end = slab->cur;
+    return slab;
+}
+
+/*
+ * slab_alloc - Return a free object, or NULL if the arena is exhausted.
+ */
+void *slab_alloc(struct slab *slab)
+{
+    void *p = slab->free_list;
+
+    if (p != NULL) {
+        slab->free_list = *(void **)p;
+        return p;
+    }
+
+    if ((size_t)(slab->end - slab->cur) < slab->obj_size) {
+        char *brk = mem_arena_sbrk(slab->arena, SLAB_GROW);
+
+        if (brk == (void *)-1) {
+            return NULL;
+        }
+        // The break only ever grows, so the new pages follow the old ones
+        // and a slot may straddle the boundary.
+        slab->end = brk + SLAB_GROW;
+    }
+    p = slab->cur;
+    slab->cur += slab->obj_size;
+    return p;
+}
+
+/*
+ * slab_free - Return the object at p, which must come from slab_alloc on
+ * the same slab, to the pool.
+ */
+void slab_free(struct slab *slab, void *p)
+{
+    if (p == NULL) {
+        return;
+    }
+    *(void **)p = slab->free_list;
+    slab->free_list = p;
+}
+
+/*
+ * slab_destroy - Release the slab and every object allocated from it.
+ */
+void slab_destroy(struct slab *slab)
+{
+    mem_arena_destroy(slab->arena);
+}
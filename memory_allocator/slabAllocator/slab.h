@@ -0,0 +1,12 @@
+#ifndef __SLAB_H__
+#define __SLAB_H__
+#include <stddef.h>
+
+struct slab;
+
+struct slab *slab_create(size_t obj_size);
+void *slab_alloc(struct slab *slab);
+void slab_free(struct slab *slab, void *p);
+void slab_destroy(struct slab *slab);
+
+#endif
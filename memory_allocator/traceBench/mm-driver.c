@@ -0,0 +1,341 @@
+/*
+ * mm-driver.c - replay allocation traces against one of the mm.h
+ * allocators and report throughput and memory utilization.
+ *
+ * A trace is a text file with one request per line:
+ *
+ *   a <id> <size>    mm_malloc(size), remembered as block <id>
+ *   r <id> <size>    mm_realloc(block <id>, size)
+ *   f <id>           mm_free(block <id>)
+ *
+ * Blank lines and lines starting with '#' are ignored. The whole trace is
+ * read and checked before the clock starts, so only allocator calls are
+ * timed. Every block gets its first and last byte tagged, and the tags are
+ * checked again on realloc and free to catch overlapping blocks.
+ *
+ * Utilization is the peak of live payload bytes over the peak heap size
+ * reported by libmem, i.e. how much of what was taken from mem_sbrk the
+ * program could actually use.
+ *
+ * Drivers for allocators with placement policies (HAVE_FIT_POLICY) take
+ * -p first, -p next or -p best:N, and also report the average number of
+ * blocks find_fit looked at per search, and the number of free blocks and
+ * the external fragmentation halfway through the trace. Fragmentation is
+ * the share of free bytes outside the largest free block.
+ *
+ * The Makefile builds one driver per allocator, e.g. mm-driver-explicit:
+ *
+ *   make && ./mm-tracegen -d small > small.rep && ./mm-driver-explicit -p next small.rep
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "mem.h"
+
+#ifndef ALLOCATOR
+#define ALLOCATOR "mm"
+#endif
+
+#define ALIGNMENT 16
+
+#ifdef HAVE_FIT_POLICY
+static const char *policy_names[] = {"first", "next", "best"};
+static enum mm_fit_policy policy = MM_FIRST_FIT;
+static int policy_candidates = 0;
+#endif
+
+/* The allocator, and its placement policy, as shown in the report */
+static char label[64] = ALLOCATOR;
+
+struct trace_op {
+    char type;      /* 'a', 'r' or 'f' */
+    int id;
+    size_t size;
+};
+
+struct trace {
+    struct trace_op *ops;
+    size_t num_ops;
+    int num_ids;
+};
+
+static double elapsed_s(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * read_trace - parse `path` into `trace` and check that every realloc and
+ * free names a live block and no live id is allocated again.
+ */
+static void read_trace(const char *path, struct trace *trace)
+{
+    FILE *fp;
+    char line[256];
+    size_t capacity = 1024;
+    int lineno = 0;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+        perror(path);
+        exit(1);
+    }
+    trace->ops = malloc(capacity * sizeof(struct trace_op));
+    trace->num_ops = 0;
+    trace->num_ids = 0;
+    if (!trace->ops) {
+        perror("malloc");
+        exit(1);
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        struct trace_op op = {0};
+        int n;
+
+        lineno++;
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        n = sscanf(line, " %c %d %zu", &op.type, &op.id, &op.size);
+        if (op.id < 0 || !((op.type == 'f' && n >= 2) ||
+                           ((op.type == 'a' || op.type == 'r') && n == 3))) {
+            fprintf(stderr, "%s:%d: bad request: %s", path, lineno, line);
+            exit(1);
+        }
+        if (trace->num_ops == capacity) {
+            capacity *= 2;
+            if ((trace->ops = realloc(trace->ops, capacity * sizeof(struct trace_op))) == NULL) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        trace->ops[trace->num_ops++] = op;
+        if (op.id >= trace->num_ids) {
+            trace->num_ids = op.id + 1;
+        }
+    }
+    fclose(fp);
+
+    char *live = calloc(trace->num_ids, 1);
+    if (trace->num_ids > 0 && !live) {
+        perror("calloc");
+        exit(1);
+    }
+    for (size_t i = 0; i < trace->num_ops; i++) {
+        struct trace_op *op = &trace->ops[i];
+
+        if ((op->type == 'a') == live[op->id]) {
+            fprintf(stderr, "%s: request %zu: block %d is %s\n", path, i, op->id,
+                    live[op->id] ? "already allocated" : "not allocated");
+            exit(1);
+        }
+        live[op->id] = op->type != 'f';
+    }
+    free(live);
+}
+
+#ifdef NO_REALLOC
+/*
+ * replay_realloc - for allocators without mm_realloc. The driver knows the
+ * old size, so it can move the block itself.
+ */
+static void *replay_realloc(void *ptr, size_t oldsize, size_t size)
+{
+    void *newptr = mm_malloc(size);
+
+    if (newptr) {
+        memcpy(newptr, ptr, oldsize < size ? oldsize : size);
+        mm_free(ptr);
+    }
+    return newptr;
+}
+#else
+#define replay_realloc(ptr, oldsize, size) mm_realloc(ptr, size)
+#endif
+
+static inline void tag_block(char *p, size_t size, int id)
+{
+    p[size - 1] = (char)(id >> 8);
+    p[0] = (char)id;
+}
+
+static inline int tag_ok(char *p, size_t size, int id)
+{
+    return p[0] == (char)id && (size == 1 || p[size - 1] == (char)(id >> 8));
+}
+
+static void replay_error(const char *path, size_t i, struct trace_op *op, const char *what)
+{
+    fprintf(stderr, "%s: request %zu (%c %d %zu): %s\n", path, i, op->type, op->id, op->size, what);
+    exit(1);
+}
+
+/*
+ * replay - run `trace` against a fresh heap and print one result line.
+ */
+static void replay(const char *path, struct trace *trace)
+{
+    char **ptrs = calloc(trace->num_ids, sizeof(char *));
+    size_t *sizes = calloc(trace->num_ids, sizeof(size_t));
+    size_t live_bytes = 0, peak_live = 0, peak_heap;
+    struct timespec start, end;
+    double secs;
+#ifdef HAVE_FIT_POLICY
+    struct mm_fit_stats mid, stats;
+    struct timespec pause, resume;
+    double paused = 0;
+#endif
+
+    if (trace->num_ids > 0 && (!ptrs || !sizes)) {
+        perror("calloc");
+        exit(1);
+    }
+
+#ifdef HAVE_FIT_POLICY
+    mm_init_policy(policy, policy_candidates);
+#else
+    mm_init();
+#endif
+    mem_heap_peak_reset();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < trace->num_ops; i++) {
+        struct trace_op *op = &trace->ops[i];
+        char *p = ptrs[op->id];
+
+#ifdef HAVE_FIT_POLICY
+        // Walking the heap is not part of the replay, so stop the clock
+        if (i == trace->num_ops / 2) {
+            clock_gettime(CLOCK_MONOTONIC, &pause);
+            mm_get_fit_stats(&mid);
+            clock_gettime(CLOCK_MONOTONIC, &resume);
+            paused = elapsed_s(&pause, &resume);
+        }
+#endif
+
+        switch (op->type) {
+        case 'a':
+            if ((p = mm_malloc(op->size)) == NULL) {
+                replay_error(path, i, op, "mm_malloc failed");
+            }
+            live_bytes += op->size;
+            break;
+        case 'r':
+            if (!tag_ok(p, sizes[op->id], op->id)) {
+                replay_error(path, i, op, "block was overwritten");
+            }
+            if ((p = replay_realloc(p, sizes[op->id], op->size)) == NULL) {
+                replay_error(path, i, op, "mm_realloc failed");
+            }
+            if (p[0] != (char)op->id) {
+                replay_error(path, i, op, "mm_realloc lost the block contents");
+            }
+            live_bytes += op->size - sizes[op->id];
+            break;
+        case 'f':
+            if (!tag_ok(p, sizes[op->id], op->id)) {
+                replay_error(path, i, op, "block was overwritten");
+            }
+            mm_free(p);
+            live_bytes -= sizes[op->id];
+            ptrs[op->id] = NULL;
+            continue;
+        }
+
+        if ((uintptr_t)p % ALIGNMENT != 0) {
+            replay_error(path, i, op, "payload is not 16-byte aligned");
+        }
+        tag_block(p, op->size, op->id);
+        ptrs[op->id] = p;
+        sizes[op->id] = op->size;
+        if (live_bytes > peak_live) {
+            peak_live = live_bytes;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    peak_heap = mem_heap_peak();
+#ifdef HAVE_FIT_POLICY
+    mm_get_fit_stats(&stats);
+#endif
+    mm_deinit();
+
+    secs = elapsed_s(&start, &end);
+#ifdef HAVE_FIT_POLICY
+    secs -= paused;
+#endif
+    printf("%-18s %-20s %9zu %9.3f %11.0f %11zu %11zu %6.1f%%",
+           label, path, trace->num_ops, secs * 1e3,
+           secs > 0 ? trace->num_ops / secs : 0.0, peak_live, peak_heap,
+           peak_heap ? 100.0 * peak_live / peak_heap : 0.0);
+#ifdef HAVE_FIT_POLICY
+    printf(" %9.1f %9zu %6.1f%%",
+           stats.searches ? (double)stats.blocks_scanned / stats.searches : 0.0, mid.free_blocks,
+           mid.free_bytes ? 100.0 * (mid.free_bytes - mid.largest_free) / mid.free_bytes : 0.0);
+#endif
+    printf("\n");
+
+    free(ptrs);
+    free(sizes);
+}
+
+static void usage(const char *prog)
+{
+#ifdef HAVE_FIT_POLICY
+    fprintf(stderr, "usage: %s [-p first|next|best[:N]] trace...\n", prog);
+#else
+    fprintf(stderr, "usage: %s trace...\n", prog);
+#endif
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:")) != -1) {
+        switch (opt) {
+#ifdef HAVE_FIT_POLICY
+        case 'p': {
+            size_t len = strcspn(optarg, ":");
+
+            for (policy = MM_FIRST_FIT; policy <= MM_BEST_FIT; policy++) {
+                if (strlen(policy_names[policy]) == len &&
+                    strncmp(optarg, policy_names[policy], len) == 0) {
+                    break;
+                }
+            }
+            if (policy > MM_BEST_FIT) {
+                usage(argv[0]);
+            }
+            policy_candidates = optarg[len] ? atoi(optarg + len + 1) : 0;
+            snprintf(label, sizeof(label), "%s/%s", ALLOCATOR, optarg);
+            break;
+        }
+#endif
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+    }
+
+    printf("%-18s %-20s %9s %9s %11s %11s %11s %7s",
+           "allocator", "trace", "ops", "ms", "ops/sec", "peak live", "peak heap", "util");
+#ifdef HAVE_FIT_POLICY
+    printf(" %9s %9s %7s", "scan/fit", "free blks", "frag");
+#endif
+    printf("\n");
+    for (int i = optind; i < argc; i++) {
+        struct trace trace;
+
+        read_trace(argv[i], &trace);
+        replay(argv[i], &trace);
+        fflush(stdout);
+        free(trace.ops);
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * mm-rbench.c - repeated doubling reallocs, the growth pattern of line
+ * arrays and string builders.
+ *
+ * Each scenario grows `buffers` buffers side by side from 16 bytes to
+ * MAX_SIZE, doubling each one in turn. A realloc that returns the same
+ * pointer was done in place; one that moves had to copy the old contents.
+ * We report how many bytes were copied and how many were saved. In an
+ * allocator with an MMAP_THRESHOLD, a buffer past it has its own mapping
+ * and mremap moves its pages without copying, so there the copied bytes
+ * are an upper bound.
+ *
+ * One source for every allocator with mm_realloc: each allocator's
+ * Makefile builds it against its own mm.c and mm.h.
+ *
+ *   make bench && ./mm-rbench    (in ImplicitFreeList or ExplicitFreeList)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mm.h"
+
+#define MAX_SIZE (16 << 20)
+#define MAX_BUFFERS 8
+
+static const int buffer_counts[] = {1, 2, 8};
+
+static double elapsed_ms(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e3 + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    printf("%8s %9s %8s %14s %14s %10s\n",
+           "buffers", "reallocs", "moved", "bytes copied", "bytes saved", "ms");
+
+    for (size_t i = 0; i < sizeof(buffer_counts) / sizeof(buffer_counts[0]); i++) {
+        int buffers = buffer_counts[i];
+        char *bufs[MAX_BUFFERS];
+        size_t copied = 0, saved = 0;
+        int reallocs = 0, moved = 0;
+        struct timespec start, end;
+
+        mm_init();
+        for (int b = 0; b < buffers; b++) {
+            bufs[b] = mm_malloc(16);
+            memset(bufs[b], b, 16);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t size = 16; size < MAX_SIZE; size *= 2) {
+            for (int b = 0; b < buffers; b++) {
+                char *p = mm_realloc(bufs[b], 2 * size);
+                if (!p) {
+                    perror("mm_realloc");
+                    exit(1);
+                }
+                reallocs++;
+                if (p != bufs[b]) {
+                    moved++;
+                    copied += size;
+                } else {
+                    saved += size;
+                }
+                // Touch the new half like a growing buffer would
+                memset(p + size, b, size);
+                bufs[b] = p;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        mm_checkheap(0);
+        mm_deinit();
+
+        printf("%8d %9d %8d %14zu %14zu %10.2f\n",
+               buffers, reallocs, moved, copied, saved, elapsed_ms(&start, &end));
+    }
+    return 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * mm-tracegen.c - write a synthetic allocation trace for mm-driver.
+ *
+ * The generator keeps about `live` blocks allocated at a time. Below that
+ * it mostly allocates, above it mostly frees a random live block, and a
+ * share of the remaining requests reallocate a random live block to a new
+ * size from the same distribution. Every block still live at the end is
+ * freed. Block sizes come from one of these distributions:
+ *
+ *   uniform   any size from 1 to max
+ *   small     mostly under 128 bytes, the greptile print-job pattern
+ *   bimodal   90% small records, 10% buffers of 4 KB up to max
+ *   pow2      powers of two from 16 to max
+ *   grow      reallocs only ever double a block, like line arrays
+ *
+ * The same seed always gives the same trace.
+ *
+ *   ./mm-tracegen -d bimodal -n 100000 -l 1000 > bimodal.rep
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+enum dist { UNIFORM, SMALL, BIMODAL, POW2, GROW };
+
+static const char *dist_names[] = {"uniform", "small", "bimodal", "pow2", "grow"};
+
+static uint64_t rng_state;
+
+/* xorshift64*, so traces do not depend on the libc rand() */
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static size_t rng_range(size_t lo, size_t hi)
+{
+    return lo + rng() % (hi - lo + 1);
+}
+
+static size_t pick_size(enum dist dist, size_t max)
+{
+    switch (dist) {
+    case UNIFORM:
+        return rng_range(1, max);
+    case SMALL:
+        // Each doubling of the size is half as likely
+        for (size_t limit = 32; limit < max; limit *= 2) {
+            if (rng() % 2) {
+                return rng_range(limit / 2 + 1, limit);
+            }
+        }
+        return rng_range(1, max);
+    case BIMODAL:
+        if (rng() % 10 != 0 || max < 4096) {
+            return rng_range(16, 64);
+        }
+        return rng_range(4096, max);
+    case POW2:
+    case GROW: {
+        size_t size = 16;
+        while (size * 2 <= max && rng() % 2) {
+            size *= 2;
+        }
+        return size;
+    }
+    }
+    return 1;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-d uniform|small|bimodal|pow2|grow] [-n ops] "
+            "[-l live] [-m max size] [-r realloc %%] [-s seed]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    enum dist dist = SMALL;
+    size_t num_ops = 100000, target_live = 1000, max_size = 65536;
+    unsigned realloc_pct = 10;
+    uint64_t seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:n:l:m:r:s:")) != -1) {
+        switch (opt) {
+        case 'd':
+            for (dist = 0; dist <= GROW && strcmp(optarg, dist_names[dist]) != 0; dist++)
+                ;
+            if (dist > GROW) {
+                usage(argv[0]);
+            }
+            break;
+        case 'n': num_ops = strtoull(optarg, NULL, 10); break;
+        case 'l': target_live = strtoull(optarg, NULL, 10); break;
+        case 'm': max_size = strtoull(optarg, NULL, 10); break;
+        case 'r': realloc_pct = strtoul(optarg, NULL, 10); break;
+        case 's': seed = strtoull(optarg, NULL, 10); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (target_live == 0 || max_size < 16 || realloc_pct > 100) {
+        usage(argv[0]);
+    }
+    rng_state = seed ? seed : 1;
+
+    // Live block ids and their sizes; a freed slot is filled from the end
+    int *live = malloc(num_ops * sizeof(int));
+    size_t *sizes = malloc(num_ops * sizeof(size_t));
+    size_t num_live = 0;
+    int next_id = 0;
+
+    if (num_ops > 0 && (!live || !sizes)) {
+        perror("malloc");
+        exit(1);
+    }
+
+    printf("# %s -d %s -n %zu -l %zu -m %zu -r %u -s %llu\n", argv[0], dist_names[dist],
+           num_ops, target_live, max_size, realloc_pct, (unsigned long long)seed);
+    for (size_t i = 0; i < num_ops; i++) {
+        int grow_live = num_live < target_live ? rng() % 4 != 0 : rng() % 4 == 0;
+
+        if (num_live == 0 || grow_live) {
+            size_t size = pick_size(dist, max_size);
+
+            live[num_live] = next_id;
+            sizes[num_live++] = size;
+            printf("a %d %zu\n", next_id++, size);
+        } else if (rng() % 100 < realloc_pct) {
+            size_t j = rng() % num_live;
+            size_t size = pick_size(dist, max_size);
+
+            if (dist == GROW) {
+                size = sizes[j] * 2 <= max_size ? sizes[j] * 2 : sizes[j];
+            }
+            sizes[j] = size;
+            printf("r %d %zu\n", live[j], size);
+        } else {
+            size_t j = rng() % num_live;
+
+            printf("f %d\n", live[j]);
+            live[j] = live[--num_live];
+            sizes[j] = sizes[num_live];
+        }
+    }
+    while (num_live > 0) {
+        printf("f %d\n", live[--num_live]);
+    }
+
+    free(live);
+    free(sizes);
+    return 0;
+}
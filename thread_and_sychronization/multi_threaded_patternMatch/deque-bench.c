@@ -0,0 +1,214 @@
+/*
+ * deque-bench.c - job hand-off throughput of the worker deques, in
+ * millions of jobs per second, against thread count.
+ *
+ * Every thread owns a deque and runs the greptile pattern: push a few jobs,
+ * pop some back, and steal from the others once its own deque is empty,
+ * until every job has been taken. Jobs carry no work, so this times the
+ * deques alone. Each job is checked to be taken exactly once. For
+ * comparison, the first column is a deque guarded by a mutex, like the
+ * one greptile used before.
+ *
+ *   make deque-bench && ./deque-bench [max threads] [jobs per thread]
+ */
+#include "greptile.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PUSH_BURST 8    /* jobs pushed before popping */
+#define POP_BURST  6    /* jobs popped back after each push burst */
+#define REPEAT     3    /* timed runs per configuration, the fastest is reported */
+
+// The mutex-guarded deque greptile used before the lock-free one
+struct locked_deque {
+    struct search_job *jobs;
+    size_t capacity, top, bottom;
+    pthread_mutex_t mutex;
+};
+
+static void locked_init(struct locked_deque *dq) {
+    dq->jobs = malloc(DEQUE_INIT * sizeof(struct search_job));
+    dq->capacity = DEQUE_INIT;
+    dq->top = dq->bottom = 0;
+    pthread_mutex_init(&dq->mutex, NULL);
+}
+
+static void locked_destroy(struct locked_deque *dq) {
+    free(dq->jobs);
+    pthread_mutex_destroy(&dq->mutex);
+}
+
+static void locked_push(struct locked_deque *dq, struct search_job job) {
+    pthread_mutex_lock(&dq->mutex);
+    if (dq->bottom - dq->top == dq->capacity) {
+        struct search_job *jobs = malloc(2 * dq->capacity * sizeof(struct search_job));
+        for (size_t i = dq->top; i != dq->bottom; i++)
+            jobs[i & (2 * dq->capacity - 1)] = dq->jobs[i & (dq->capacity - 1)];
+        free(dq->jobs);
+        dq->jobs = jobs;
+        dq->capacity *= 2;
+    }
+    dq->jobs[dq->bottom++ & (dq->capacity - 1)] = job;
+    pthread_mutex_unlock(&dq->mutex);
+}
+
+static bool locked_pop(struct locked_deque *dq, struct search_job *job) {
+    bool found = false;
+    pthread_mutex_lock(&dq->mutex);
+    if (dq->bottom != dq->top) {
+        *job = dq->jobs[--dq->bottom & (dq->capacity - 1)];
+        found = true;
+    }
+    pthread_mutex_unlock(&dq->mutex);
+    return found;
+}
+
+static bool locked_steal(struct locked_deque *dq, struct search_job *job) {
+    bool found = false;
+    pthread_mutex_lock(&dq->mutex);
+    if (dq->bottom != dq->top) {
+        *job = dq->jobs[dq->top++ & (dq->capacity - 1)];
+        found = true;
+    }
+    pthread_mutex_unlock(&dq->mutex);
+    return found;
+}
+
+struct bench_thread {
+    pthread_t thread;
+    int id;
+    union {
+        struct job_deque lock_free;
+        struct locked_deque locked;
+    } dq;
+};
+
+static struct bench_thread *threads;
+static int num_threads;
+static bool use_locked;
+static size_t jobs_per_thread;
+static size_t taken;              /* jobs taken so far (atomic) */
+static unsigned char *seen;       /* times each job was taken */
+
+static void push(struct bench_thread *t, struct search_job job) {
+    if (use_locked)
+        locked_push(&t->dq.locked, job);
+    else
+        deque_push(&t->dq.lock_free, job);
+}
+
+static bool pop(struct bench_thread *t, struct search_job *job) {
+    return use_locked ? locked_pop(&t->dq.locked, job) : deque_pop(&t->dq.lock_free, job);
+}
+
+static bool steal(struct bench_thread *t, struct search_job *job) {
+    return use_locked ? locked_steal(&t->dq.locked, job) : deque_steal(&t->dq.lock_free, job);
+}
+
+static void take(struct search_job *job) {
+    __atomic_add_fetch(&seen[job->chunk], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&taken, 1, __ATOMIC_RELAXED);
+}
+
+static void *run(void *arg) {
+    struct bench_thread *t = arg;
+    size_t total = jobs_per_thread * num_threads;
+    size_t next = 0, first = t->id * jobs_per_thread;
+    struct search_job job = {.kind = JOB_FILE};
+
+    while (next < jobs_per_thread) {
+        for (int i = 0; i < PUSH_BURST && next < jobs_per_thread; i++) {
+            job.chunk = first + next++;
+            push(t, job);
+        }
+        for (int i = 0; i < POP_BURST && pop(t, &job); i++)
+            take(&job);
+    }
+    while (__atomic_load_n(&taken, __ATOMIC_RELAXED) < total) {
+        if (pop(t, &job)) {
+            take(&job);
+            continue;
+        }
+        for (int i = 1; i < num_threads; i++) {
+            if (steal(&threads[(t->id + i) % num_threads], &job)) {
+                take(&job);
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Returns the fastest of REPEAT runs, in seconds
+static double bench(int n) {
+    double best = 0;
+    size_t total = jobs_per_thread * n;
+
+    num_threads = n;
+    for (int r = 0; r < REPEAT; r++) {
+        struct timespec start, end;
+
+        memset(seen, 0, total);
+        taken = 0;
+        for (int i = 0; i < n; i++) {
+            threads[i].id = i;
+            if (use_locked)
+                locked_init(&threads[i].dq.locked);
+            else
+                deque_init(&threads[i].dq.lock_free);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < n; i++)
+            pthread_create(&threads[i].thread, NULL, run, &threads[i]);
+        for (int i = 0; i < n; i++)
+            pthread_join(threads[i].thread, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        for (size_t i = 0; i < total; i++) {
+            if (seen[i] != 1) {
+                fprintf(stderr, "%s: job %zu taken %d times\n",
+                        use_locked ? "mutex" : "lock-free", i, seen[i]);
+                exit(1);
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            if (use_locked)
+                locked_destroy(&threads[i].dq.locked);
+            else
+                deque_destroy(&threads[i].dq.lock_free);
+        }
+
+        double s = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        if (r == 0 || s < best)
+            best = s;
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+    jobs_per_thread = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+
+    threads = aligned_alloc(CACHE_LINE, max_threads * sizeof(struct bench_thread));
+    seen = malloc(jobs_per_thread * max_threads);
+    if (!threads || !seen) {
+        perror("malloc");
+        exit(1);
+    }
+
+    printf("%zu jobs per thread, Mjobs/s\n", jobs_per_thread);
+    printf("%8s %10s %10s\n", "threads", "mutex", "lock-free");
+    for (int n = 1; n <= max_threads; n *= 2) {
+        use_locked = true;
+        double locked = bench(n);
+        use_locked = false;
+        double lock_free = bench(n);
+        printf("%8d %10.1f %10.1f\n", n, jobs_per_thread * n / locked / 1e6,
+               jobs_per_thread * n / lock_free / 1e6);
+    }
+    free(threads);
+    free(seen);
+    return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * deque.c - lock-free work-stealing deques for the greptile workers.
+ *
+ * This is the Chase-Lev deque, with the memory orderings of Lê, Pop, Cohen
+ * and Zappa Nardelli, "Correct and Efficient Work-Stealing for Weak Memory
+ * Models". The owner pushes and pops at the bottom without any atomic
+ * read-modify-write, except when it races a thief for the last job; thieves
+ * take from the top with a compare-and-swap on `top`. Nothing ever blocks,
+ * so a worker that is descheduled holding a deque can't stall the others.
+ *
+ * Jobs are stored by value, and a thief may read a slot that the owner is
+ * overwriting after the thief has lost the race for it, so slot fields are
+ * read and written with relaxed atomics. The thief then fails its CAS and
+ * drops what it read.
+ *
+ * When the array fills up the owner copies it into one twice the size and
+ * publishes that. A thief may still be reading the old array, so it is
+ * kept on the `retired` list until the deque is destroyed; as the arrays
+ * double, the retired ones never add up to more than the current one.
+ */
+#include "greptile.h"
+
+#include <stdlib.h>
+
+static struct deque_array *array_new(size_t capacity) {
+    struct deque_array *a = malloc(sizeof(*a) + capacity * sizeof(struct search_job));
+    if (!a) {
+        perror("malloc() failed");
+        exit(2);
+    }
+    a->capacity = capacity;
+    a->retired = NULL;
+    return a;
+}
+
+static void slot_store(struct deque_array *a, int64_t i, struct search_job job) {
+    struct search_job *slot = &a->jobs[i & (a->capacity - 1)];
+
+    __atomic_store_n(&slot->kind, job.kind, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->file_path, job.file_path, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->batch, job.batch, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->file, job.file, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->chunk, job.chunk, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->seq, job.seq, __ATOMIC_RELAXED);
+}
+
+static struct search_job slot_load(struct deque_array *a, int64_t i) {
+    struct search_job *slot = &a->jobs[i & (a->capacity - 1)];
+
+    return (struct search_job){
+        .kind = __atomic_load_n(&slot->kind, __ATOMIC_RELAXED),
+        .file_path = __atomic_load_n(&slot->file_path, __ATOMIC_RELAXED),
+        .batch = __atomic_load_n(&slot->batch, __ATOMIC_RELAXED),
+        .file = __atomic_load_n(&slot->file, __ATOMIC_RELAXED),
+        .chunk = __atomic_load_n(&slot->chunk, __ATOMIC_RELAXED),
+        .seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED),
+    };
+}
+
+void deque_init(struct job_deque *dq) {
+    dq->top = 0;
+    dq->bottom = 0;
+    dq->array = array_new(DEQUE_INIT);
+}
+
+// Only once no thread can touch the deque any more
+void deque_destroy(struct job_deque *dq) {
+    struct deque_array *a = dq->array;
+
+    while (a) {
+        struct deque_array *retired = a->retired;
+        free(a);
+        a = retired;
+    }
+}
+
+// Adds n jobs at the bottom, the last one newest, doubling the array until
+// they fit. They are published together with one store to bottom. Owner only.
+void deque_push_batch(struct job_deque *dq, const struct search_job *jobs, size_t n) {
+    int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED);
+    int64_t t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    struct deque_array *a = __atomic_load_n(&dq->array, __ATOMIC_RELAXED);
+
+    if (b - t + (int64_t)n > (int64_t)a->capacity) {
+        size_t capacity = a->capacity;
+        while (b - t + (int64_t)n > (int64_t)capacity)
+            capacity *= 2;
+
+        struct deque_array *grown = array_new(capacity);
+        for (int64_t i = t; i < b; i++)
+            slot_store(grown, i, slot_load(a, i));
+        grown->retired = a;
+        __atomic_store_n(&dq->array, grown, __ATOMIC_RELEASE);
+        a = grown;
+    }
+    for (size_t i = 0; i < n; i++)
+        slot_store(a, b + i, jobs[i]);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&dq->bottom, b + n, __ATOMIC_RELAXED);
+}
+
+// Adds a job at the bottom. Owner only.
+void deque_push(struct job_deque *dq, struct search_job job) {
+    deque_push_batch(dq, &job, 1);
+}
+
+// Takes the newest job. Owner only.
+bool deque_pop(struct job_deque *dq, struct search_job *job) {
+    int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED) - 1;
+    struct deque_array *a = __atomic_load_n(&dq->array, __ATOMIC_RELAXED);
+
+    // Claim the bottom job before looking at top, so a thief that reads
+    // bottom after this sees one job fewer
+    __atomic_store_n(&dq->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t t = __atomic_load_n(&dq->top, __ATOMIC_RELAXED);
+
+    if (t > b) {
+        // Empty
+        __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    *job = slot_load(a, b);
+    if (t < b)
+        return true;
+
+    // The last job: race the thieves for it
+    bool won = __atomic_compare_exchange_n(&dq->top, &t, t + 1, false,
+                                           __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+    return won;
+}
+
+// Takes the oldest job. Any thread may steal; returns false once the deque
+// is seen empty.
+bool deque_steal(struct job_deque *dq, struct search_job *job) {
+    while (1) {
+        int64_t t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+
+        if (t >= b)
+            return false;
+
+        struct deque_array *a = __atomic_load_n(&dq->array, __ATOMIC_ACQUIRE);
+        *job = slot_load(a, t);
+        if (__atomic_compare_exchange_n(&dq->top, &t, t + 1, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            return true;
+        // Lost to the owner or another thief; look again
+    }
+}
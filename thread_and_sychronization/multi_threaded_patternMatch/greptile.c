@@ -1,18 +1,20 @@
 #include "greptile.h"
+#include "scan.h"
 #include <dirent.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <unistd.h>
 
-#define MAX_FILES 1024
-#define NUM_THREADS 4
-
 #define COLOR_RED     "\x1B[91m"
 #define COLOR_MAGENTA "\x1B[95m"
 #define COLOR_GREEN   "\x1B[92m"
@@ -29,315 +31,910 @@ static inline void error(char *msg) {
 }
 
 
-static struct search_ring_buffer search_rb;
+/*
+ * Scheduler
+ *
+ * Every worker pops jobs off its own deque and, when that is empty, steals
+ * from the others. A worker that finds nothing anywhere sleeps on the
+ * `wake_seq` futex until a job is submitted or all work is done; submitters
+ * bump `wake_seq` before waking it, so a worker that read the old value
+ * just before sleeping doesn't sleep at all. Handing off a job takes no
+ * lock, and only costs a system call when a worker is asleep.
+ *
+ * `queued` counts jobs sitting in deques and `outstanding` counts jobs not
+ * yet finished, plus one while the directory walk is running, so the
+ * workers can tell "nothing to steal right now" from "all done". A
+ * submitter bumps `queued` and then checks `idle_workers`, and a worker
+ * going to sleep bumps `idle_workers` and then checks `queued`; with both
+ * sequentially consistent, at least one of them sees the other, so a
+ * wake-up is never lost.
+ */
+// workers[num_workers] stands for the main thread: it owns a deque too,
+// which holds the first directory, or with --sort-files every file the
+// main thread's walk finds, and the workers steal from it like any other.
+struct worker {
+    pthread_t thread;
+    int id;
+    struct job_deque deque;
+    struct file_buffer fb;  /* reused for every small file this worker reads */
+    struct match_list matches; /* matches of the file being searched */
+    struct out_buf out;     /* output of the file being searched */
+    uint64_t files_searched;  /* files and bytes this worker has searched, */
+    uint64_t bytes_searched;  /* for sizing the batches its walks make */
+    uint64_t found_match;
+};
+
+static struct worker *workers;
+static int num_workers;
+static pthread_mutex_t out_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int wake_seq;
+static size_t queued;
+static size_t outstanding = 1;
+static int idle_workers;
+static const char *search_pattern;
+
+static void futex_wait(unsigned int *addr, unsigned int val) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
 
-void rb_init(struct search_ring_buffer *rb, size_t capacity) {
-    rb->jobs = malloc(capacity * sizeof(struct search_job));
-    if (!rb->jobs)
-        error("malloc() failed");
+static void futex_wake(unsigned int *addr, int n) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
 
-    rb->capacity = capacity;
-    rb->num_jobs = 0;
-    rb->enqueue_index = 0;
-    rb->dequeue_index = 0;
+// Queues n jobs on worker w's deque and wakes up to n sleeping workers
+static void submit_jobs(struct worker *w, const struct search_job *jobs, size_t n) {
+    __atomic_add_fetch(&outstanding, n, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&queued, n, __ATOMIC_SEQ_CST);
+    deque_push_batch(&w->deque, jobs, n);
 
-    if (pthread_mutex_init(&rb->mutex, NULL) != 0)
-        error("pthread_mutex_init() failed");
-    if (pthread_cond_init(&rb->has_job_cond, NULL) != 0)
-        error("pthread_cond_init() failed");
-    if (pthread_cond_init(&rb->has_space_cond, NULL) != 0)
-        error("pthread_cond_init() failed");
+    if (__atomic_load_n(&idle_workers, __ATOMIC_SEQ_CST) > 0) {
+        __atomic_add_fetch(&wake_seq, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&wake_seq, n < INT_MAX ? (int)n : INT_MAX);
+    }
 }
 
-void rb_destroy(struct search_ring_buffer *rb) {
-    free(rb->jobs);
-    pthread_mutex_destroy(&rb->mutex);
-    pthread_cond_destroy(&rb->has_job_cond);
-    pthread_cond_destroy(&rb->has_space_cond);
+static void submit_job(struct worker *w, struct search_job job) {
+    submit_jobs(w, &job, 1);
 }
 
-void rb_enqueue(struct search_ring_buffer *rb, char *file_path, off_t file_size) {
-    pthread_mutex_lock(&rb->mutex);
+// Marks a job finished; the last one wakes every worker so they can exit
+static void finish_job(void) {
+    if (__atomic_sub_fetch(&outstanding, 1, __ATOMIC_SEQ_CST) == 0) {
+        __atomic_add_fetch(&wake_seq, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&wake_seq, INT_MAX);
+    }
+}
 
-    // Wait until there's space in the ring buffer
-    while (rb->num_jobs == rb->capacity)
-        pthread_cond_wait(&rb->has_space_cond, &rb->mutex);
+// Gets the next job for worker w: its own newest job, else the oldest job
+// of another worker, else it sleeps until there is one. Returns false once
+// all work is done.
+static bool next_job(struct worker *w, struct search_job *job) {
+    while (1) {
+        if (deque_pop(&w->deque, job)) {
+            __atomic_sub_fetch(&queued, 1, __ATOMIC_SEQ_CST);
+            return true;
+        }
+        for (int i = 1; i <= num_workers; i++) {
+            struct worker *victim = &workers[(w->id + i) % (num_workers + 1)];
+            if (deque_steal(&victim->deque, job)) {
+                __atomic_sub_fetch(&queued, 1, __ATOMIC_SEQ_CST);
+                return true;
+            }
+        }
 
-    rb->jobs[rb->enqueue_index] = (struct search_job){file_path, file_size};
-    rb->enqueue_index = (rb->enqueue_index + 1) % rb->capacity;
-    rb->num_jobs++;
+        unsigned int seq = __atomic_load_n(&wake_seq, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&idle_workers, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&queued, __ATOMIC_SEQ_CST) == 0 &&
+            __atomic_load_n(&outstanding, __ATOMIC_SEQ_CST) > 0)
+            futex_wait(&wake_seq, seq);
+        __atomic_sub_fetch(&idle_workers, 1, __ATOMIC_SEQ_CST);
 
-    pthread_cond_signal(&rb->has_job_cond);
-    pthread_mutex_unlock(&rb->mutex);
+        if (__atomic_load_n(&outstanding, __ATOMIC_SEQ_CST) == 0)
+            return false;
+    }
 }
 
-struct search_job rb_dequeue(struct search_ring_buffer *rb) {
-    struct search_job job;
-    pthread_mutex_lock(&rb->mutex);
-
-    // Wait until the ring buffer is not empty
-    while (rb->num_jobs == 0)
-        pthread_cond_wait(&rb->has_job_cond, &rb->mutex);
+static void ml_add(struct match_list *ml, const char *line, int line_len, const char *match,
+                   int line_num) {
+    if (ml->count == ml->cap) {
+        size_t cap = ml->cap ? 2 * ml->cap : 64;
+        struct match *items = realloc(ml->items, cap * sizeof(struct match));
+        if (!items)
+            error("realloc() failed");
+        ml->items = items;
+        ml->cap = cap;
+    }
+    ml->items[ml->count++] = (struct match){line, match, line_len, line_num};
+}
 
-    job = rb->jobs[rb->dequeue_index];
-    rb->dequeue_index = (rb->dequeue_index + 1) % rb->capacity;
-    rb->num_jobs--;
+// Makes room for n more bytes in ob
+static void out_reserve(struct out_buf *ob, size_t n) {
+    if (ob->len + n <= ob->cap)
+        return;
+
+    size_t cap = ob->cap ? ob->cap : 4096;
+    while (cap < ob->len + n)
+        cap *= 2;
+    char *data = realloc(ob->data, cap);
+    if (!data)
+        error("realloc() failed");
+    ob->data = data;
+    ob->cap = cap;
+}
 
-    pthread_cond_signal(&rb->has_space_cond);
-    pthread_mutex_unlock(&rb->mutex);
-    return job;
+static void out_append(struct out_buf *ob, const char *s, size_t n) {
+    out_reserve(ob, n);
+    memcpy(ob->data + ob->len, s, n);
+    ob->len += n;
 }
 
-void pq_init(struct print_queue *pq, char *file_path) {
-    pq->file_path = file_path;
-    pq->head = NULL;
-    pq->tail = NULL;
+static void out_number(struct out_buf *ob, unsigned int n) {
+    char digits[10];
+    int i = sizeof(digits);
+
+    do {
+        digits[--i] = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    out_append(ob, digits + i, sizeof(digits) - i);
 }
 
-void pq_add_tail(struct print_queue *pq, char *line, char *match, int line_num) {
-    struct print_job *job = malloc(sizeof(struct print_job));
-    if (!job)
-        error("malloc() failed");
+// Formats the file name line that comes before a file's matches into ob
+static void format_file_name(struct out_buf *ob, const char *file_path) {
+    const char *name = file_path + file_print_offset;
 
-    job->line = line;
-    job->match = match;
-    job->line_num = line_num;
-    job->next = NULL;
+    if (colorize)
+        out_append(ob, COLOR_MAGENTA, sizeof(COLOR_MAGENTA) - 1);
+    out_append(ob, name, strlen(name));
+    if (colorize)
+        out_append(ob, COLOR_RESET, sizeof(COLOR_RESET) - 1);
+    out_append(ob, "\n", 1);
+}
 
-    if (pq->head == NULL) {
-        pq->head = job;
-        pq->tail = job;
-    } else {
-        pq->tail->next = job;
-        pq->tail = job;
+// Formats every match of ml into ob, its line number offset by line_base
+static void format_matches(struct out_buf *ob, struct match_list *ml, int line_base) {
+    for (size_t i = 0; i < ml->count; i++) {
+        struct match *m = &ml->items[i];
+
+        if (colorize) {
+            size_t match_offset = m->match - m->line;
+            out_append(ob, COLOR_GREEN, sizeof(COLOR_GREEN) - 1);
+            out_number(ob, m->line_num + line_base);
+            out_append(ob, COLOR_RESET ":", sizeof(COLOR_RESET ":") - 1);
+            out_append(ob, m->line, match_offset);
+            out_append(ob, COLOR_RED, sizeof(COLOR_RED) - 1);
+            out_append(ob, search_pattern, pattern_len);
+            out_append(ob, COLOR_RESET, sizeof(COLOR_RESET) - 1);
+            out_append(ob, m->match + pattern_len, m->line_len - match_offset - pattern_len);
+        } else {
+            out_number(ob, m->line_num + line_base);
+            out_append(ob, ":", 1);
+            out_append(ob, m->line, m->line_len);
+        }
+        out_append(ob, "\n", 1);
     }
 }
 
-struct print_job *pq_pop_front(struct print_queue *pq) {
-    if (pq->head == NULL)
-        return NULL;
+static void write_all(const char *p, size_t left) {
+    while (left > 0) {
+        ssize_t n = write(STDOUT_FILENO, p, left);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            error("write() failed");
+        }
+        p += n;
+        left -= n;
+    }
+}
 
-    struct print_job *job = pq->head;
-    pq->head = job->next;
+// Writes out everything in ob at once, so the output of different files
+// never interleaves, and empties it
+static void out_flush(struct out_buf *ob) {
+    pthread_mutex_lock(&out_mutex);
+    write_all(ob->data, ob->len);
+    pthread_mutex_unlock(&out_mutex);
+    ob->len = 0;
+}
 
-    return job;
+/*
+ * Reorder buffer for --sort-files
+ *
+ * The walk numbers files in the order it finds them, and each file's
+ * output, empty or not, is left in slot seq % sort_window. Whoever fills
+ * the slot `next_seq` writes it out along with every ready slot after it.
+ * The walk never runs more than sort_window files ahead of `next_seq`, so
+ * a slot is always free when its file is done, and at most sort_window
+ * outputs are held. Handing the output over swaps buffers with the slot,
+ * whose buffer was emptied when it was last written, so nothing is
+ * allocated once every slot has been used.
+ */
+struct reorder_slot {
+    struct out_buf out;
+    bool ready;
+};
+
+static bool sort_files;
+static size_t sort_window = SORT_WINDOW;
+static struct reorder_slot *reorder;
+static size_t next_seq;     /* next file to write out; written under out_mutex */
+static pthread_cond_t window_cond = PTHREAD_COND_INITIALIZER;
+
+static void reorder_put(struct out_buf *ob, size_t seq) {
+    pthread_mutex_lock(&out_mutex);
+
+    struct reorder_slot *slot = &reorder[seq % sort_window];
+    struct out_buf filled = *ob;
+    *ob = slot->out;
+    slot->out = filled;
+    slot->ready = true;
+
+    size_t next = next_seq;
+    while ((slot = &reorder[next % sort_window])->ready) {
+        write_all(slot->out.data, slot->out.len);
+        slot->out.len = 0;
+        slot->ready = false;
+        next++;
+    }
+    if (next != next_seq) {
+        __atomic_store_n(&next_seq, next, __ATOMIC_RELEASE);
+        pthread_cond_signal(&window_cond);
+    }
+    pthread_mutex_unlock(&out_mutex);
 }
 
-void pq_print(struct print_queue *pq, const char *pattern) {
-    struct print_job *job;
+// Waits until file seq fits in the reorder window
+static void reorder_wait(size_t seq) {
+    if (seq < __atomic_load_n(&next_seq, __ATOMIC_ACQUIRE) + sort_window)
+        return;
 
-    if (colorize)
-        printf(COLOR_MAGENTA "%s\n" COLOR_RESET, pq->file_path + file_print_offset);
-    else
-        printf("%s\n", pq->file_path + file_print_offset);
+    pthread_mutex_lock(&out_mutex);
+    while (seq >= next_seq + sort_window)
+        pthread_cond_wait(&window_cond, &out_mutex);
+    pthread_mutex_unlock(&out_mutex);
+}
 
-    while ((job = pq_pop_front(pq)) != NULL) {
-        int match_offset = job->match - job->line; // Must be int to work with %.*s
+// Hands over the output of file seq, which may be empty: in file order
+// with --sort-files, at once otherwise
+static void finish_output(struct out_buf *ob, size_t seq) {
+    if (sort_files)
+        reorder_put(ob, seq);
+    else if (ob->len > 0)
+        out_flush(ob);
+}
 
-        if (colorize) {
-            printf(COLOR_GREEN "%d" COLOR_RESET ":%.*s" COLOR_RED "%s" COLOR_RESET "%s\n",
-                job->line_num,
-                match_offset, job->line,
-                pattern,
-                job->match + pattern_len);
-        } else {
-            printf("%d:%s\n", job->line_num, job->line);
-        }
+// Reads a small file of `size` bytes from fd into the worker's buffer
+// with pread, growing the buffer if it is too small
+static int read_small_file(int fd, size_t size, struct file_buffer *fb) {
+    if (size > fb->buf_cap) {
+        char *buf = realloc(fb->buf, size);
+        if (!buf)
+            error("realloc() failed");
+        fb->buf = buf;
+        fb->buf_cap = size;
+    }
 
-        free(job);
+    size_t total = 0;
+    while (total < size) {
+        ssize_t n = pread(fd, fb->buf + total, size - total, total);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            break; // The file shrank since we looked at it
+        total += n;
     }
+    fb->data = fb->buf;
+    fb->len = total;
+    return 0;
 }
 
-// the following function reads the file into the buffer
-// by line using fread
-char *read_file_into_buffer(char *path, size_t file_size) {
-
-    FILE *file = fopen(path, "r");
-    if (!file) {
-        perror("Failed to open file");
-        return NULL;
-    }   
-    // Get the file descriptor from the FILE * using fileno
-    int fd = fileno(file);
+// Opens the file at path and makes its contents available in fb->data.
+// Files of MMAP_MIN_SIZE bytes or more are mapped read-only and the kernel
+// is told we read them front to back, so it reads ahead aggressively;
+// smaller ones, where setting up a mapping costs more than the copy, are
+// read into the worker's reused buffer. Either way no per-file buffer is
+// allocated. Returns -1 after printing a message if the file can't be read.
+int read_file_into_buffer(const char *path, struct file_buffer *fb) {
+    fb->data = NULL;
+    fb->len = 0;
+    fb->map = NULL;
+
+    int fd = open(path, O_RDONLY);
     if (fd == -1) {
-        perror("Failed to get file descriptor");
-        fclose(file);  // Close the file pointer
-        return NULL;
+        perror(path);
+        return -1;
     }
 
-    // Use fstat to get file information
+    // The walk doesn't stat files, so find the size here
     struct stat file_info;
     if (fstat(fd, &file_info) == -1) {
-        perror("Failed to get file stats");
-        fclose(file);  // Close the file pointer
-        return NULL;
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    size_t size = file_info.st_size;
+
+    if (size >= MMAP_MIN_SIZE) {
+        void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+            close(fd);
+            fb->data = fb->map = map;
+            fb->len = fb->map_len = size;
+            return 0;
+        }
+        // Fall back to reading it
     }
 
-    size_t filesize = file_info.st_size;  // Get the file size from fstat
+    int ret = read_small_file(fd, size, fb);
+    if (ret < 0)
+        perror(path);
+    close(fd);
+    return ret;
+}
 
-    // allocate memory on the heap for the file contents
-    char *buf = malloc(filesize + 1);
-    if (!buf)
-        error("malloc() failed");
-  
-    size_t items_read = fread(buf, 1, filesize, file);
-    if (items_read != file_size) {
-        if (ferror(file)) {
-            // Error occurred during the fread operation
-            perror("Error reading file");
-        } else if (feof(file)) {
-        // End of file reached before reading the expected number of bytes
-         fprintf(stderr, "Warning: End of file reached, only %zu bytes read out of %zu\n", items_read, file_size);
+// Unmaps the file in fb if it was mapped; the per-thread buffer is kept
+void release_file_buffer(struct file_buffer *fb) {
+    if (fb->map) {
+        munmap(fb->map, fb->map_len);
+        fb->map = NULL;
     }
+}
 
-    }
+// Searches [start, end), which begins at the start of a line, adding
+// every matching line to ml, numbered from 1 at start.
+// Only the lines around matches are located: their number and start by
+// counting the newlines since the last matching line, their end with
+// memchr. The buffer is not NUL-terminated, and the last line may not end
+// in a newline. If count_all is set, returns the number of newlines in the
+// range; otherwise the newlines after the last match are not counted.
+static size_t search_range(const char *start, const char *end, struct match_list *ml,
+                           bool count_all) {
+    const char *line = start; // start of the line after the last match
+    const char *match, *last_newline;
+    int line_num = 1;
+
+    while (line < end && (match = scan_find(line, end - line, search_pattern, pattern_len))) {
+        const char *line_start = line;
+        size_t newlines = scan_count_newlines(line, match - line, &last_newline);
+        if (newlines > 0) {
+            line_start = last_newline + 1;
+            line_num += newlines;
+        }
 
-    fclose(file);
-    return buf;
-}
+        const char *newline = memchr(match, '\n', end - match);
+        const char *line_end = newline ? newline : end;
+
+        ml_add(ml, line_start, line_end - line_start, match, line_num);
 
-char *search_pattern_in_line(const char *line, const char *pattern) {
-    return strstr(line, pattern);  // Returns pointer to the match or NULL if not found
+        // Only the first match on a line is reported
+        if (!newline)
+            return line_num - 1;
+        line = line_end + 1;
+        line_num++;
+    }
+    if (count_all && line < end)
+        line_num += scan_count_newlines(line, end - line, &last_newline);
+    return line_num - 1;
 }
 
-// Returns void * for pthread_create() signature
-void *search_files(void *arg) {
-    const char *pattern = arg;
-    uint64_t found_match = 0;
+// Splits the mapped file in fb into line-aligned chunks and queues all but
+// the first on worker w's deque, where idle workers can steal them.
+// Returns the chunked file, which now owns the mapping and file_path.
+static struct chunked_file *split_file(struct worker *w, char *file_path, size_t seq,
+                                       struct file_buffer *fb) {
+    int num_chunks = fb->len / CHUNK_SIZE;
+    struct chunked_file *cf = malloc(sizeof(*cf) + num_chunks * sizeof(struct file_chunk));
+    if (!cf)
+        error("malloc() failed");
 
-    while(1) {
-        struct search_job job = rb_dequeue(&search_rb);
+    cf->file_path = file_path;
+    cf->map = fb->map;
+    cf->map_len = fb->map_len;
+    cf->seq = seq;
+    cf->num_chunks = num_chunks;
+    cf->chunks_left = num_chunks;
+    fb->map = NULL;
+
+    // Each chunk after the first starts just past the first newline at or
+    // after its nominal start, so no line is split
+    const char *end = fb->data + fb->len;
+    const char *start = fb->data;
+    for (int i = 0; i < num_chunks; i++) {
+        const char *next = end;
+        if (i + 1 < num_chunks) {
+            const char *nominal = fb->data + (size_t)(i + 1) * CHUNK_SIZE;
+            const char *from = nominal > start ? nominal - 1 : start;
+            const char *newline = memchr(from, '\n', end - from);
+            next = newline ? newline + 1 : end;
+        }
+        cf->chunks[i].start = start;
+        cf->chunks[i].end = next;
+        cf->chunks[i].matches = (struct match_list){0};
+        start = next;
+    }
 
-        off_t file_size = job.file_size;
-        char *file_path = job.file_path;
-        if (file_path == NULL)
-            pthread_exit((void *)found_match);
+    for (int i = 1; i < num_chunks; i++)
+        submit_job(w, (struct search_job){.kind = JOB_CHUNK, .file = cf, .chunk = i});
+    return cf;
+}
 
-        char *buf = read_file_into_buffer(file_path, file_size);
-        if (!buf) {
-            error("error");
-       
+// Searches one chunk. The worker that finishes the last chunk of a file
+// formats every chunk's matches in file order, renumbered, writes them
+// out, unmaps the file and frees it.
+static void search_chunk(struct worker *w, struct chunked_file *cf, int i) {
+    struct file_chunk *chunk = &cf->chunks[i];
+
+    // Only the chunks before the last need their newlines counted
+    chunk->newlines = search_range(chunk->start, chunk->end, &chunk->matches, i + 1 < cf->num_chunks);
+    if (chunk->matches.count)
+        w->found_match = 1;
+
+    // The release/acquire pair makes every chunk's results visible to the
+    // worker that finishes last
+    if (__atomic_sub_fetch(&cf->chunks_left, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    int line_base = 0;
+    for (int c = 0; c < cf->num_chunks; c++) {
+        struct match_list *ml = &cf->chunks[c].matches;
+        if (ml->count) {
+            if (w->out.len == 0)
+                format_file_name(&w->out, cf->file_path);
+            format_matches(&w->out, ml, line_base);
         }
+        free(ml->items);
+        line_base += cf->chunks[c].newlines;
+    }
+    finish_output(&w->out, cf->seq);
+    munmap(cf->map, cf->map_len);
+    free(cf->file_path);
+    free(cf);
+}
 
-        buf[file_size] = '\0';
-
-        struct print_queue pq;
-        pq_init(&pq, file_path);
-          // Process the file content line by line
-        char *next_line = buf;
-        char *line = strtok_r(next_line, "\n", &next_line); // Use strtok_r for thread-safety
-
-        int line_num = 1;
-        while (line) {
-            char *match = search_pattern_in_line(line, pattern);
-             // Returns pointer to the match or NULL if not found
-            if (match) {
-                pq_add_tail(&pq, line, match, line_num);
-                found_match = 1;
-            }
+// Searches a whole file, or splits it into chunks if it is mapped and at
+// least two chunks long
+static void search_file(struct worker *w, char *file_path, size_t seq) {
+    struct file_buffer *fb = &w->fb;
 
-            line = strtok_r(next_line, "\n", &next_line); // Move to next line
-            line_num++;
-        }
-        // Print matches
-        if (pq.head != NULL) {
-            flockfile(stdout);
-            pq_print(&pq, pattern);
-            funlockfile(stdout);
-        }
-        // free the path and the buffer
-        free(buf);
+    if (read_file_into_buffer(file_path, fb) < 0) {
+        finish_output(&w->out, seq);
         free(file_path);
+        return;
+    }
+    w->files_searched++;
+    w->bytes_searched += fb->len;
+
+    if (fb->map && fb->len >= 2 * CHUNK_SIZE) {
+        struct chunked_file *cf = split_file(w, file_path, seq, fb);
+        search_chunk(w, cf, 0);
+        return;
+    }
+
+    w->matches.count = 0;
+    search_range(fb->data, fb->data + fb->len, &w->matches, false);
+
+    // Print matches
+    if (w->matches.count) {
+        w->found_match = 1;
+        format_file_name(&w->out, file_path);
+        format_matches(&w->out, &w->matches, 0);
     }
+    finish_output(&w->out, seq);
+    // unmap the file and free the path
+    release_file_buffer(fb);
+    free(file_path);
+}
+
+// Searches every file of a batch, the first of which is file seq
+static void search_batch(struct worker *w, struct file_batch *batch, size_t seq) {
+    for (int i = 0; i < batch->count; i++)
+        search_file(w, batch->paths[i], seq + i);
+    free(batch);
+}
+
+// Files per batch for worker w's walks: enough to cover about BATCH_BYTES
+// at the average size of the files w has searched so far, so a batch of
+// tiny files is worth a steal and big files still spread over the workers
+static int batch_size(struct worker *w) {
+    if (w->files_searched == 0)
+        return BATCH_INIT;
+
+    uint64_t avg = w->bytes_searched / w->files_searched;
+    if (avg * BATCH_MAX <= BATCH_BYTES)
+        return BATCH_MAX;
+    return avg >= BATCH_BYTES ? 1 : BATCH_BYTES / avg;
 }
 
 /* 
- * `tranverse_directory` handles different file types, increments counters for regular files 
- * and directories, and handles errors like permission denial or stat errors.
+ * `traverse_directory` lists one directory and queues a job for every
+ * subdirectory, and for every batch of regular files, in it on worker w's
+ * deque, so directories are walked in parallel by whichever workers pick
+ * them up. Jobs are published PUBLISH_MAX at a time rather than one by one.
+ * Entries are classified by the d_type readdir returns, and only the few
+ * entries of file systems that leave it DT_UNKNOWN are stat'ed, with
+ * fstatat relative to the directory's fd. Symbolic links and special files
+ * are skipped. A directory that can't be read is reported and skipped.
  */  
-void traverse_directory(const char *path) {
+static void traverse_directory(struct worker *w, char *path) {
+    struct search_job pending[PUBLISH_MAX];
+    struct file_batch *batch = NULL;
+    int num_pending = 0, max_batch = batch_size(w);
     struct dirent *entry;
     DIR *dp;
-    struct stat statbuf;
 
-    if(lstat(path, &statbuf) < 0){
-        error("cant stat");
-    }
-    // Construct the full path of the directory
-    if((dp = opendir(path)) == NULL){
-        error("can't open");
+    int dir_fd = open(path, O_RDONLY | O_DIRECTORY);
+    if (dir_fd == -1 || (dp = fdopendir(dir_fd)) == NULL) {
+        perror(path);
+        if (dir_fd != -1)
+            close(dir_fd);
+        free(path);
+        return;
     }
+    size_t dir_len = strlen(path);
 
     while ((entry = readdir(dp))) {
         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
             continue;
 
-        // Allocate enough space for the path, a slash, the entry name, and a null byte
-        size_t path_size = (strlen(path) + 1 + strlen(entry->d_name) + 1) * sizeof(char);
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat statbuf;
+            if (fstatat(dir_fd, entry->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) == -1)
+                continue;
+            type = S_ISDIR(statbuf.st_mode) ? DT_DIR : S_ISREG(statbuf.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        if (type != DT_DIR && type != DT_REG)
+            continue;
 
-        char *full_path = malloc(path_size);
+        // Allocate enough space for the path, a slash, the entry name, and a null byte
+        size_t name_len = strlen(entry->d_name);
+        char *full_path = malloc(dir_len + 1 + name_len + 1);
         if (!full_path)
             error("malloc() failed");
+        memcpy(full_path, path, dir_len);
+        full_path[dir_len] = '/';
+        memcpy(full_path + dir_len + 1, entry->d_name, name_len + 1);
+
+        // full_path will be freed by the worker that takes the job
+        if (type == DT_DIR) {
+            pending[num_pending++] = (struct search_job){.kind = JOB_DIR, .file_path = full_path};
+        } else if (max_batch == 1) {
+            pending[num_pending++] = (struct search_job){.kind = JOB_FILE, .file_path = full_path};
+        } else {
+            if (!batch) {
+                batch = malloc(sizeof(*batch) + max_batch * sizeof(char *));
+                if (!batch)
+                    error("malloc() failed");
+                batch->count = 0;
+            }
+            batch->paths[batch->count++] = full_path;
+            if (batch->count == max_batch) {
+                pending[num_pending++] = (struct search_job){.kind = JOB_FILES, .batch = batch};
+                batch = NULL;
+            }
+        }
 
-        snprintf(full_path, path_size, "%s/%s", path, entry->d_name);
+        if (num_pending == PUBLISH_MAX) {
+            submit_jobs(w, pending, num_pending);
+            num_pending = 0;
+        }
+    }
 
-        if (lstat(full_path, &statbuf) == -1)
-            error("lstat() failed");
+    if (batch)
+        pending[num_pending++] = (struct search_job){.kind = JOB_FILES, .batch = batch};
+    if (num_pending > 0)
+        submit_jobs(w, pending, num_pending);
 
-        if (S_ISDIR(statbuf.st_mode)) {
-            traverse_directory(full_path);
-            free(full_path);
-        } else if (S_ISREG(statbuf.st_mode) && statbuf.st_size != 0) {
-            rb_enqueue(&search_rb, full_path, statbuf.st_size);
-            // full_path will be freed by a worker thread
-        } else {
-            free(full_path);
+    closedir(dp);
+    free(path);
+}
+
+/*
+ * Walk for --sort-files. The main thread walks the tree depth first,
+ * with each directory's entries sorted by name, so files come in path
+ * order, and numbers them for the reorder buffer. It queues them in
+ * batches on its own deque, where the workers steal them, so the search
+ * stays parallel; only the walk itself is serial.
+ */
+struct sorted_walk {
+    struct worker *w;                       /* the main thread's entry */
+    size_t seq;                             /* number of the next file */
+    struct search_job pending[PUBLISH_MAX]; /* jobs not yet queued */
+    int num_pending;
+    struct file_batch *batch;               /* batch being filled */
+    size_t batch_seq;                       /* number of its first file */
+};
+
+struct sorted_entry {
+    char *path;
+    unsigned char type;
+};
+
+static int sorted_entry_cmp(const void *a, const void *b) {
+    return strcmp(((const struct sorted_entry *)a)->path, ((const struct sorted_entry *)b)->path);
+}
+
+// Queues the pending jobs and the partly filled batch
+static void walk_publish(struct sorted_walk *sw) {
+    if (sw->batch) {
+        sw->pending[sw->num_pending++] =
+            (struct search_job){.kind = JOB_FILES, .batch = sw->batch, .seq = sw->batch_seq};
+        sw->batch = NULL;
+    }
+    if (sw->num_pending > 0)
+        submit_jobs(sw->w, sw->pending, sw->num_pending);
+    sw->num_pending = 0;
+}
+
+static void walk_add_file(struct sorted_walk *sw, char *path) {
+    if (sw->seq >= __atomic_load_n(&next_seq, __ATOMIC_ACQUIRE) + sort_window) {
+        // The file the output waits for may be in what we hold back
+        walk_publish(sw);
+        reorder_wait(sw->seq);
+    }
+    if (!sw->batch) {
+        sw->batch = malloc(sizeof(*sw->batch) + BATCH_INIT * sizeof(char *));
+        if (!sw->batch)
+            error("malloc() failed");
+        sw->batch->count = 0;
+        sw->batch_seq = sw->seq;
+    }
+    sw->batch->paths[sw->batch->count++] = path;
+    sw->seq++;
+    if (sw->batch->count == BATCH_INIT) {
+        sw->pending[sw->num_pending++] =
+            (struct search_job){.kind = JOB_FILES, .batch = sw->batch, .seq = sw->batch_seq};
+        sw->batch = NULL;
+        if (sw->num_pending == PUBLISH_MAX)
+            walk_publish(sw);
+    }
+}
+
+// Walks the directory open at dir_fd, whose path is path, and closes it
+static void walk_sorted(struct sorted_walk *sw, int dir_fd, const char *path) {
+    struct sorted_entry *entries = NULL;
+    size_t num_entries = 0, cap = 0;
+    struct dirent *entry;
+    DIR *dp;
+
+    if ((dp = fdopendir(dir_fd)) == NULL) {
+        perror(path);
+        close(dir_fd);
+        return;
+    }
+    size_t dir_len = strlen(path);
+
+    while ((entry = readdir(dp))) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat statbuf;
+            if (fstatat(dir_fd, entry->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) == -1)
+                continue;
+            type = S_ISDIR(statbuf.st_mode) ? DT_DIR : S_ISREG(statbuf.st_mode) ? DT_REG : DT_UNKNOWN;
         }
+        if (type != DT_DIR && type != DT_REG)
+            continue;
+
+        if (num_entries == cap) {
+            cap = cap ? 2 * cap : 64;
+            entries = realloc(entries, cap * sizeof(struct sorted_entry));
+            if (!entries)
+                error("realloc() failed");
+        }
+        size_t name_len = strlen(entry->d_name);
+        char *full_path = malloc(dir_len + 1 + name_len + 1);
+        if (!full_path)
+            error("malloc() failed");
+        memcpy(full_path, path, dir_len);
+        full_path[dir_len] = '/';
+        memcpy(full_path + dir_len + 1, entry->d_name, name_len + 1);
+        entries[num_entries++] = (struct sorted_entry){full_path, type};
     }
 
+    // Every path has the same prefix, so this sorts by name
+    qsort(entries, num_entries, sizeof(struct sorted_entry), sorted_entry_cmp);
+
+    for (size_t i = 0; i < num_entries; i++) {
+        if (entries[i].type == DT_REG) {
+            // The path will be freed by the worker that searches it
+            walk_add_file(sw, entries[i].path);
+            continue;
+        }
+        int fd = openat(dir_fd, entries[i].path + dir_len + 1, O_RDONLY | O_DIRECTORY);
+        if (fd == -1)
+            perror(entries[i].path);
+        else
+            walk_sorted(sw, fd, entries[i].path);
+        free(entries[i].path);
+    }
+    free(entries);
     closedir(dp);
 }
 
+// Returns void * for pthread_create() signature
+void *search_files(void *arg) {
+    struct worker *w = arg;
+    struct search_job job;
+
+    while (next_job(w, &job)) {
+        if (job.kind == JOB_DIR)
+            traverse_directory(w, job.file_path);
+        else if (job.kind == JOB_FILES)
+            search_batch(w, job.batch, job.seq);
+        else if (job.kind == JOB_CHUNK)
+            search_chunk(w, job.file, job.chunk);
+        else
+            search_file(w, job.file_path, job.seq);
+        finish_job();
+    }
+    free(w->fb.buf);
+    free(w->matches.items);
+    free(w->out.data);
+    return NULL;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: greptile [-j threads] [-p] [--sort-files] [--sort-window files]\n"
+                    "                <pattern> [directory]\n");
+    exit(2);
+}
 
 int main(int argc, char **argv) {
     char *directory_path = ".";
     char *pattern;
+    bool pin = false;
+    cpu_set_t cpus;
+    int opt;
+    static const struct option long_options[] = {
+        {"sort-files", no_argument, NULL, 'S'},
+        {"sort-window", required_argument, NULL, 'W'},
+        {NULL, 0, NULL, 0},
+    };
+
+    // One worker per CPU this process may run on, unless -j says otherwise
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+        num_workers = CPU_COUNT(&cpus);
+    } else {
+        num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+        if (num_workers < 1)
+            num_workers = 1;
+        CPU_ZERO(&cpus);
+        for (int i = 0; i < num_workers && i < CPU_SETSIZE; i++)
+            CPU_SET(i, &cpus);
+    }
+
+    while ((opt = getopt_long(argc, argv, "j:p", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'j': {
+            char *end;
+            long n = strtol(optarg, &end, 10);
+            if (*end != '\0' || n < 1 || n > MAX_THREADS) {
+                fprintf(stderr, "greptile: -j takes 1 to %d threads\n", MAX_THREADS);
+                exit(2);
+            }
+            num_workers = n;
+            break;
+        }
+        case 'p':
+            pin = true; // pin worker i to the i-th CPU we may run on
+            break;
+        case 'S':
+            sort_files = true; // print files in path order
+            break;
+        case 'W': {
+            // Most files whose output may wait for an earlier file's
+            char *end;
+            long n = strtol(optarg, &end, 10);
+            if (*end != '\0' || n < 1) {
+                fprintf(stderr, "greptile: --sort-window takes a positive number of files\n");
+                exit(2);
+            }
+            sort_window = n;
+            break;
+        }
+        default:
+            usage();
+        }
+    }
 
-    if (argc == 2) {
-        pattern = argv[1];
+    if (argc - optind == 1) {
+        pattern = argv[optind];
         file_print_offset = 2; // Skip "./" prefix if no directory argument
-    } else if (argc == 3) {
-        pattern = argv[1];
-        directory_path = argv[2];
+    } else if (argc - optind == 2) {
+        pattern = argv[optind];
+        directory_path = argv[optind + 1];
         file_print_offset = 0; // Print full path if directory argument is given
     } else {
-        fprintf(stderr, "usage: greptile <pattern> [directory]\n");
-        exit(2);
+        usage();
     }
 
     pattern_len = strlen(pattern);
+    scan_init();
     colorize = isatty(STDOUT_FILENO);
     uint64_t any_threads_matched = 0;
 
-    rb_init(&search_rb, MAX_FILES);
+    search_pattern = pattern;
 
-    pthread_t threads[NUM_THREADS];
-    for (int i = 0; i < NUM_THREADS; i++)
-        pthread_create(&threads[i], NULL, search_files, (void *)pattern);
+    // Subdirectories that can't be read are skipped, but the top one must be
+    int top_fd = open(directory_path, O_RDONLY | O_DIRECTORY);
+    if (top_fd == -1)
+        error("can't open");
 
-    // main thread tranverse the directory and 
-    traverse_directory(directory_path);
-    for (int i = 0; i < NUM_THREADS; i++)
-        rb_enqueue(&search_rb, NULL, 0);
+    // The workers, and the main thread's entry after them
+    workers = aligned_alloc(CACHE_LINE, (num_workers + 1) * sizeof(struct worker));
+    if (!workers)
+        error("aligned_alloc() failed");
+    memset(workers, 0, (num_workers + 1) * sizeof(struct worker));
+    for (int i = 0; i <= num_workers; i++) {
+        workers[i].id = i;
+        deque_init(&workers[i].deque);
+    }
+    struct worker *main_worker = &workers[num_workers];
 
-    // Wait for worker threads to finish 
-    for (int i = 0; i < NUM_THREADS; i++) {
-        uint64_t thread_matched = 0;
-        pthread_join(threads[i], (void **)&thread_matched);
-        any_threads_matched |= thread_matched;
+    if (sort_files) {
+        reorder = calloc(sort_window, sizeof(struct reorder_slot));
+        if (!reorder)
+            error("calloc() failed");
+    } else {
+        // The walk starts with a job for the top directory, and the
+        // workers queue the rest as they find it
+        char *top = strdup(directory_path);
+        if (!top)
+            error("strdup() failed");
+        submit_job(main_worker, (struct search_job){.kind = JOB_DIR, .file_path = top});
+        close(top_fd);
     }
 
-    rb_destroy(&search_rb);
+    int cpu = -1;
+    for (int i = 0; i < num_workers; i++) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+
+        if (pin) {
+            // The next CPU in our affinity mask, wrapping around
+            cpu_set_t one;
+            do {
+                cpu = (cpu + 1) % CPU_SETSIZE;
+            } while (!CPU_ISSET(cpu, &cpus));
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            pthread_attr_setaffinity_np(&attr, sizeof(one), &one);
+        }
+        if (pthread_create(&workers[i].thread, &attr, search_files, &workers[i]) != 0)
+            error("pthread_create() failed");
+        pthread_attr_destroy(&attr);
+    }
+
+    if (sort_files) {
+        struct sorted_walk sw = {.w = main_worker};
+        walk_sorted(&sw, top_fd, directory_path);
+        walk_publish(&sw);
+    }
+
+    // Then main drops its hold on `outstanding` so the workers can finish
+    finish_job();
+
+    // Wait for worker threads to finish 
+    for (int i = 0; i < num_workers; i++) {
+        pthread_join(workers[i].thread, NULL);
+        any_threads_matched |= workers[i].found_match;
+    }
+    // Other workers may steal from a deque until they have all exited
+    for (int i = 0; i <= num_workers; i++)
+        deque_destroy(&workers[i].deque);
+    free(workers);
+    if (sort_files) {
+        for (size_t i = 0; i < sort_window; i++)
+            free(reorder[i].out.data);
+        free(reorder);
+    }
 
     // Return 0 if any thread found a match, 1 otherwise
     return any_threads_matched == 0;
@@ -2,6 +2,8 @@
 #define _GREPTILE_H
 
 #define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE     /* for the DT_* types of struct dirent */
+#define _GNU_SOURCE         /* for sched_getaffinity and thread affinity */
 #if defined(SOLARIS)
 #define _XOPEN_SOURCE 600
 #else
@@ -10,9 +12,17 @@
 
 #define PATHMAX 2048
 #define MAX_LINE 30
-#define MAX_FILES 1024
-#define NUM_THREADS 4
+#define MAX_THREADS 1024          /* most workers -j accepts */
 #define MAXLINE 4096
+#define MMAP_MIN_SIZE (64 * 1024) /* files this large are mapped, smaller ones are read */
+#define CHUNK_SIZE (1024 * 1024)  /* mapped files of two chunks or more are searched in chunks */
+#define DEQUE_INIT 64             /* initial capacity of a worker's job deque */
+#define CACHE_LINE 64
+#define BATCH_BYTES (256 * 1024)  /* file bytes a batch of files aims to cover */
+#define BATCH_MAX 64              /* most files in a batch */
+#define BATCH_INIT 8              /* files in a batch before any file is searched */
+#define PUBLISH_MAX 256           /* most jobs a directory walk queues at once */
+#define SORT_WINDOW 1024          /* files --sort-files may run ahead of the output */
 
 
 #include <sys/types.h>
@@ -30,48 +40,112 @@
 #include <fcntl.h>
 #include <ctype.h>
 #include <dirent.h>
+#include <pthread.h>
+
+// a match waiting to be printed
+struct match {
+    const char *line; // line where match is found
+    const char *match; // points to the match within line and color match
+    int line_len; // length of line, which is not NUL-terminated
+    int line_num; // line number where the match is found
+};
+// the matches of a file or chunk, in file order, in an array that grows by
+// doubling and is reused, so a match costs no allocation
+struct match_list {
+    struct match *items;
+    size_t count;
+    size_t cap;
+};
+// a worker's formatted output, written out a whole file at a time
+struct out_buf {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+// A byte range of a large file, starting and ending on line boundaries.
+// Chunks are searched independently; line numbers are fixed up once all
+// of them are done, from the newline count of the chunks before.
+struct file_chunk {
+    const char *start;      /* first byte of the chunk */
+    const char *end;        /* one past the last byte */
+    size_t newlines;        /* newlines in [start, end) */
+    struct match_list matches; /* numbered from the chunk start */
+};
+
+// A large file being searched in chunks. The last worker to finish a
+// chunk prints the matches of the whole file and unmaps it.
+struct chunked_file {
+    char *file_path;
+    void *map;
+    size_t map_len;
+    size_t seq;             /* place in the output (--sort-files) */
+    int num_chunks;
+    int chunks_left;        /* chunks not yet searched (atomic) */
+    struct file_chunk chunks[];
+};
+
+// Files of one directory handed out as a single job, so one pop or steal
+// moves many small files
+struct file_batch {
+    int count;
+    char *paths[];
+};
+
+enum job_kind {
+    JOB_DIR,    /* list a directory and queue jobs for its entries */
+    JOB_FILE,   /* search a whole file */
+    JOB_FILES,  /* search each file of a batch */
+    JOB_CHUNK,  /* search one chunk of a chunked file */
+};
 
 /*initialize a search job*/
 struct search_job {
-    char *file_path; /* File path for the job (read-only) */
-    off_t file_size; /*filesize of job*/
+    enum job_kind kind;
+    char *file_path; /* File or directory path for the job (JOB_FILE, JOB_DIR) */
+    struct file_batch *batch; /* files of the job (JOB_FILES) */
+    struct chunked_file *file; /* file of the chunk (JOB_CHUNK) */
+    int chunk;        /* index of the chunk (JOB_CHUNK) */
+    size_t seq;       /* place of the file, or the batch's first, in the output (--sort-files) */
 };
 
-
-// Ring buffer for thread communication
-struct search_ring_buffer {
-    struct search_job *jobs;  /*copies of jobs in ring buffer*/
-    size_t capacity;     /*capacity or max length of ring buffer*/
-    int num_jobs;       /*number of jobs in ring buffer*/
-    int enqueue_index;  /*write index of ring buffer*/
-    int dequeue_index; /*read index of ring buffer*/
-    pthread_mutex_t mutex; /*mutex to protect jobs*/
-    pthread_cond_t has_job_cond; /*conditional mutex for removing jobs*/
-    pthread_cond_t has_space_cond; /*conditional mutex for adding jobs*/
+// Circular array of a job deque, replaced by one twice the size when full
+struct deque_array {
+    size_t capacity;              /* power of two */
+    struct deque_array *retired;  /* smaller arrays thieves may still read */
+    struct search_job jobs[];
 };
 
-// when a job is successfully dequeud from a ring buffer, 
-struct print_job {
-    char *line; // line where match is found
-    char *match; // points to the match within line and color match
-    int line_num; // line number where the match is found
-    struct print_job *next; //
+// Each worker owns a lock-free deque of jobs (see deque.c). The owner
+// pushes and pops at the bottom, newest first, while idle workers steal
+// from the top, oldest first, so a thief takes the work the owner is
+// furthest from reaching. top and bottom are on their own cache lines, so
+// thieves hitting top don't slow the owner working at bottom.
+struct job_deque {
+    _Alignas(CACHE_LINE) int64_t top;    /* index of the oldest job, where thieves take */
+    _Alignas(CACHE_LINE) int64_t bottom; /* one past the newest job, where the owner works */
+    struct deque_array *array;
 };
-// prints all job in a queue in a FIFO manner
-struct print_queue {
-    char *file_path;
-    struct print_job *head;
-    struct print_job *tail;
+
+// Contents of the file a worker is searching. Small files are read into
+// the worker's own buffer, which is reused from file to file; large files
+// are mapped. Neither is NUL-terminated.
+struct file_buffer {
+    const char *data; /* file contents */
+    size_t len;       /* bytes in data */
+    void *map;        /* mapping to unmap when done, or NULL */
+    size_t map_len;   /* length of map */
+    char *buf;        /* per-thread buffer for small files */
+    size_t buf_cap;   /* capacity of buf */
 };
 
 
-void rb_init(struct search_ring_buffer *rb, size_t capacity);
-void rb_destroy(struct search_ring_buffer *rb);
-bool rb_empty(struct search_ring_buffer *rb);
-bool rb_full(struct search_ring_buffer *rb);
-void rb_enqueue(struct search_ring_buffer *rb, char *file_path, off_t file_size);
-struct search_job rb_dequeue(struct search_ring_buffer *rb);
-void traverse_directory(const char *path);
+void deque_init(struct job_deque *dq);
+void deque_destroy(struct job_deque *dq);
+void deque_push(struct job_deque *dq, struct search_job job);
+void deque_push_batch(struct job_deque *dq, const struct search_job *jobs, size_t n);
+bool deque_pop(struct job_deque *dq, struct search_job *job);
+bool deque_steal(struct job_deque *dq, struct search_job *job);
 
 
 void err_cont(int error, const char *fmt, ...);
@@ -0,0 +1,144 @@
+/*
+ * scan-bench.c - search throughput of each scan implementation, in GB/s.
+ *
+ * Fills a buffer with random lines of text, then runs the same loop the
+ * greptile workers run (find the next match, count the newlines before it,
+ * skip to the end of its line) with every implementation, and checks that
+ * they all report the same matching lines. For comparison, the first row
+ * is the line-at-a-time strtok_r/strstr loop greptile used before.
+ *
+ *   make scan-bench && ./scan-bench [pattern] [MB]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "scan.h"
+
+#define REPEAT 5    /* timed passes per implementation, the fastest is reported */
+
+static const char *words[] = {
+    "the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog", "error",
+    "warning", "request", "served", "in", "ms", "GET", "/index.html", "200",
+};
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double elapsed_s(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// The greptile worker loop, without the printing. Returns the number of
+// matching lines, and the sum of their line numbers in *line_sum.
+static size_t search(const char *buf, size_t len, const char *pattern, size_t plen,
+                     uint64_t *line_sum) {
+    const char *end = buf + len, *line = buf, *match, *last_newline;
+    size_t matches = 0, line_num = 1;
+
+    *line_sum = 0;
+    while (line < end && (match = scan_find(line, end - line, pattern, plen))) {
+        line_num += scan_count_newlines(line, match - line, &last_newline);
+        const char *newline = memchr(match, '\n', end - match);
+        matches++;
+        *line_sum += line_num;
+        line = (newline ? newline : end) + 1;
+        line_num++;
+    }
+    return matches;
+}
+
+// The old greptile loop: split the NUL-terminated buffer into lines with
+// strtok_r and strstr each one. Returns the number of matching lines.
+static size_t search_strtok(char *buf, const char *pattern) {
+    char *next = buf, *line;
+    size_t matches = 0;
+
+    while ((line = strtok_r(next, "\n", &next)) != NULL) {
+        if (strstr(line, pattern))
+            matches++;
+    }
+    return matches;
+}
+
+int main(int argc, char **argv) {
+    const char *pattern = argc > 1 ? argv[1] : "lazy dog error";
+    size_t mb = argc > 2 ? strtoul(argv[2], NULL, 10) : 256;
+    size_t len = mb << 20, n = 0, plen = strlen(pattern);
+    static const char *impls[] = {"memchr", "sse2", "avx2"};
+    size_t expect_matches = 0;
+    uint64_t expect_sum = 0;
+
+    char *buf = malloc(len + 1), *copy = malloc(len + 1);
+    if (!buf || !copy) {
+        perror("malloc");
+        exit(1);
+    }
+    while (n < len) {
+        const char *w = words[rng() % (sizeof(words) / sizeof(words[0]))];
+        size_t wlen = strlen(w);
+        if (n + wlen + 1 > len)
+            break;
+        memcpy(buf + n, w, wlen);
+        n += wlen;
+        buf[n++] = rng() % 10 == 0 ? '\n' : ' ';
+    }
+    len = n;
+    buf[len] = '\0';
+
+    printf("pattern \"%s\", %zu MB\n", pattern, mb);
+    printf("%8s %10s %10s\n", "impl", "matches", "GB/s");
+
+    double best = 0;
+    size_t matches = 0;
+    for (int r = 0; r < REPEAT; r++) {
+        struct timespec start, end;
+
+        // strtok_r writes into the buffer, so give it a fresh copy
+        memcpy(copy, buf, len + 1);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        matches = search_strtok(copy, pattern);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (r == 0 || elapsed_s(&start, &end) < best)
+            best = elapsed_s(&start, &end);
+    }
+    printf("%8s %10zu %10.2f\n", "strtok", matches, len / best / 1e9);
+
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        uint64_t sum = 0;
+
+        if (scan_select(impls[i]) < 0) {
+            printf("%8s %10s\n", impls[i], "n/a");
+            continue;
+        }
+        for (int r = 0; r < REPEAT; r++) {
+            struct timespec start, end;
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            matches = search(buf, len, pattern, plen, &sum);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            if (r == 0 || elapsed_s(&start, &end) < best)
+                best = elapsed_s(&start, &end);
+        }
+        if (i == 0) {
+            expect_matches = matches;
+            expect_sum = sum;
+        } else if (matches != expect_matches || sum != expect_sum) {
+            fprintf(stderr, "%s disagrees with memchr: %zu matches, line sum %lu\n",
+                    impls[i], matches, (unsigned long)sum);
+            exit(1);
+        }
+        printf("%8s %10zu %10.2f\n", impls[i], matches, len / best / 1e9);
+    }
+    free(buf);
+    free(copy);
+    return 0;
+}
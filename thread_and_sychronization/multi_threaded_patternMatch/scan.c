@@ -0,0 +1,195 @@
+#include "scan.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+/*
+ * The vector searches use the first/last byte filter: for every position i
+ * in a block, compare buf[i] with the first byte of the pattern and
+ * buf[i + plen - 1] with the last, AND the two masks, and only run memcmp
+ * on the middle of the pattern at the positions that survive. On text, the
+ * two byte tests together reject almost every position, so the search runs
+ * at close to the speed of the loads.
+ *
+ * The portable versions are built on memchr and memcmp, which the C library
+ * already vectorizes where it can.
+ */
+
+static const char *find_memchr(const char *buf, size_t len, const char *pattern, size_t plen) {
+    const char *end = buf + len;
+    const char *p = buf;
+
+    while ((size_t)(end - p) >= plen) {
+        p = memchr(p, pattern[0], end - p - plen + 1);
+        if (!p)
+            return NULL;
+        if (memcmp(p + 1, pattern + 1, plen - 1) == 0)
+            return p;
+        p++;
+    }
+    return NULL;
+}
+
+static size_t count_memchr(const char *buf, size_t len, const char **last) {
+    const char *end = buf + len;
+    const char *p = buf;
+    size_t count = 0;
+
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+        count++;
+        *last = p++;
+    }
+    return count;
+}
+
+#ifdef HAVE_X86_SIMD
+// plen is at least 2
+static const char *find_sse2(const char *buf, size_t len, const char *pattern, size_t plen) {
+    const __m128i first = _mm_set1_epi8(pattern[0]);
+    const __m128i last = _mm_set1_epi8(pattern[plen - 1]);
+    size_t i = 0;
+
+    for (; i + plen - 1 + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(buf + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(buf + i + plen - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                                        _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(buf + i + bit + 1, pattern + 1, plen - 2) == 0)
+                return buf + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return find_memchr(buf + i, len - i, pattern, plen);
+}
+
+static size_t count_sse2(const char *buf, size_t len, const char **last) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t count = 0, i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, newline));
+        if (mask) {
+            count += __builtin_popcount(mask);
+            *last = buf + i + 31 - __builtin_clz(mask);
+        }
+    }
+    return count + count_memchr(buf + i, len - i, last);
+}
+
+// plen is at least 2
+__attribute__((target("avx2")))
+static const char *find_avx2(const char *buf, size_t len, const char *pattern, size_t plen) {
+    const __m256i first = _mm256_set1_epi8(pattern[0]);
+    const __m256i last = _mm256_set1_epi8(pattern[plen - 1]);
+    size_t i = 0;
+
+    // 64 bytes a step, as two 32-byte halves whose masks are combined
+    for (; i + plen - 1 + 64 <= len; i += 64) {
+        const char *p = buf + i;
+        __m256i a0 = _mm256_loadu_si256((const __m256i *)p);
+        __m256i a1 = _mm256_loadu_si256((const __m256i *)(p + 32));
+        __m256i b0 = _mm256_loadu_si256((const __m256i *)(p + plen - 1));
+        __m256i b1 = _mm256_loadu_si256((const __m256i *)(p + plen - 1 + 32));
+        __m256i m0 = _mm256_and_si256(_mm256_cmpeq_epi8(a0, first), _mm256_cmpeq_epi8(b0, last));
+        __m256i m1 = _mm256_and_si256(_mm256_cmpeq_epi8(a1, first), _mm256_cmpeq_epi8(b1, last));
+        if (_mm256_testz_si256(_mm256_or_si256(m0, m1), _mm256_or_si256(m0, m1)))
+            continue;
+
+        uint64_t mask = (uint32_t)_mm256_movemask_epi8(m0) |
+                        (uint64_t)(uint32_t)_mm256_movemask_epi8(m1) << 32;
+        while (mask) {
+            int bit = __builtin_ctzll(mask);
+            if (memcmp(p + bit + 1, pattern + 1, plen - 2) == 0)
+                return p + bit;
+            mask &= mask - 1;
+        }
+    }
+    return find_sse2(buf + i, len - i, pattern, plen);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t count_avx2(const char *buf, size_t len, const char **last) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t count = 0, i = 0;
+
+    for (; i + 64 <= len; i += 64) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)(buf + i));
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(buf + i + 32));
+        uint64_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v0, newline)) |
+                        (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, newline)) << 32;
+        if (mask) {
+            count += __builtin_popcountll(mask);
+            *last = buf + i + 63 - __builtin_clzll(mask);
+        }
+    }
+    return count + count_sse2(buf + i, len - i, last);
+}
+#endif
+
+static const char *(*find_impl)(const char *, size_t, const char *, size_t) = find_memchr;
+static size_t (*count_impl)(const char *, size_t, const char **) = count_memchr;
+static const char *impl_name = "memchr";
+
+// Picks the widest implementation this CPU supports
+void scan_init(void) {
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        scan_select("avx2");
+    } else {
+        scan_select("sse2");
+    }
+#endif
+}
+
+// Picks an implementation by name. Returns -1 if it is unknown or this
+// CPU can't run it.
+int scan_select(const char *name) {
+    if (strcmp(name, "memchr") == 0) {
+        find_impl = find_memchr;
+        count_impl = count_memchr;
+        impl_name = "memchr";
+#ifdef HAVE_X86_SIMD
+    } else if (strcmp(name, "sse2") == 0) {
+        find_impl = find_sse2;
+        count_impl = count_sse2;
+        impl_name = "sse2";
+    } else if (strcmp(name, "avx2") == 0) {
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("popcnt"))
+            return -1;
+        find_impl = find_avx2;
+        count_impl = count_avx2;
+        impl_name = "avx2";
+#endif
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+const char *scan_name(void) {
+    return impl_name;
+}
+
+const char *scan_find(const char *buf, size_t len, const char *pattern, size_t plen) {
+    if (plen == 0)
+        return buf;
+    if (plen > len)
+        return NULL;
+    if (plen == 1)
+        return memchr(buf, pattern[0], len);
+    return find_impl(buf, len, pattern, plen);
+}
+
+size_t scan_count_newlines(const char *buf, size_t len, const char **last) {
+    return count_impl(buf, len, last);
+}
@@ -0,0 +1,29 @@
+#ifndef _SCAN_H
+#define _SCAN_H
+
+#include <stddef.h>
+
+/*
+ * Buffer scanning for greptile. The whole file is searched for the pattern
+ * in one pass, and lines are only located around the matches: the start of
+ * a line and its number come from counting newlines between matches, the
+ * end from a memchr past the match.
+ *
+ * Each routine has a portable version built on memchr, an SSE2 and an AVX2
+ * version. scan_init picks the widest one the CPU supports, and scan_select
+ * picks one by name ("memchr", "sse2" or "avx2") for benchmarking. Both
+ * must be called before any other thread scans.
+ */
+
+void scan_init(void);
+int scan_select(const char *name);
+const char *scan_name(void);
+
+/* First occurrence of pattern (plen bytes) in the len bytes at buf, or NULL */
+const char *scan_find(const char *buf, size_t len, const char *pattern, size_t plen);
+
+/* Number of newlines in the len bytes at buf; *last is set to the last one,
+ * and left alone if there are none */
+size_t scan_count_newlines(const char *buf, size_t len, const char **last);
+
+#endif  /* _SCAN_H */